@@ -0,0 +1,45 @@
+#!/bin/bash
+#
+# make bench -- time wdclink and wdcdumpobj over generated inputs.
+#
+# BENCH_SIZES (small medium large) and BENCH_DIR (bench) may be overridden.
+#
+
+set -e
+
+DIR=${BENCH_DIR:-bench}
+SIZES=${BENCH_SIZES:-"small medium large"}
+TIMEFORMAT=%R
+
+params() {
+	case $1 in
+		small)	echo "-m 100 -l 2 -L 100" ;;
+		medium)	echo "-m 1000 -l 4 -L 400" ;;
+		large)	echo "-m 4000 -l 8 -L 500" ;;
+		*) echo "Unknown size: $1" >&2; exit 1 ;;
+	esac
+}
+
+mbs() {
+	awk -v b=$1 -v t=$2 'BEGIN { if (t > 0) printf "%.1f", b / 1e6 / t; else printf "-" }'
+}
+
+printf "%-8s %7s %10s %10s %9s %10s %9s\n" size files "input" "link (s)" "MB/s" "dump (s)" "MB/s"
+
+for size in $SIZES ; do
+	d=$DIR/$size
+	rm -rf "$d"
+	mkdir -p "$d"
+	./wdcgenobj -o "$d" $(params $size)
+
+	files=$(ls "$d" | wc -l)
+	bytes=$(cat "$d"/*.obj "$d"/*.lib | wc -c)
+	libs=""
+	for f in "$d"/*.lib ; do libs="$libs -l $(basename "$f" .lib)" ; done
+
+	link=$( { time ./wdclink -o "$d/out.omf" -L "$d" $libs "$d"/obj*.obj >/dev/null 2>&1 ; } 2>&1 )
+	dump=$( { time ./wdcdumpobj "$d"/*.obj "$d"/*.lib >/dev/null 2>&1 ; } 2>&1 )
+
+	printf "%-8s %7d %10d %10s %9s %10s %9s\n" $size $files $bytes \
+		$link $(mbs $bytes $link) $dump $(mbs $bytes $dump)
+done
@@ -42,26 +42,6 @@ static constexpr const char opcodes[] =
 	"sedsbcplxxcejsrsbcincsbc"
 	;
 
-static constexpr const int mImplied =      0x0000;
-static constexpr const int mImmediate =    0x1000;
-static constexpr const int mAbsolute =     0x2000;
-static constexpr const int mAbsoluteI =    0x3000;
-static constexpr const int mAbsoluteIL =   0x4000;
-static constexpr const int mAbsoluteLong = 0x5000;
-static constexpr const int mDP =           0x6000;
-static constexpr const int mDPI =          0x7000;
-static constexpr const int mDPIL =         0x8000;
-static constexpr const int mRelative =     0x9000;
-static constexpr const int mBlockMove =    0xa000;
-static constexpr const int mImpliedA =     0xb000; // inc a, dec a, etc.
-
-static constexpr const int m_S =          0x0100;
-static constexpr const int m_X =          0x0200;
-static constexpr const int m_Y =          0x0400;
-
-static constexpr const int m_M =          0x0020;
-static constexpr const int m_I =          0x0010;
-
 static constexpr const int modes[] =
 {
 	1 | mAbsolute,              // 00 brk #imm
@@ -370,115 +350,193 @@ static bool branchlike(uint8_t op) {
 }
 
 
-constexpr const int kOpcodeTab = 20;
-constexpr const int kOperandTab = 30;
-constexpr const int kCommentTab = 80;
+uint32_t instruction::target() const {
 
+	uint32_t pc = this->pc + size + operand;
 
-void indent_to(std::string &line, unsigned position) {
-	if (line.length() < position)
-		line.resize(position, ' ');
+	if ((size == 2) && (operand & 0x80))
+		pc += 0xff00;
+	return pc & 0xffff;
 }
 
-
-disassembler::~disassembler() {
+uint8_t instruction::next_flags() const {
+	switch(opcode) {
+		case 0xc2: // REP
+			return flags | (operand & 0x30);
+		case 0xe2: // SEP
+			return flags & ~(operand & 0x30);
+		default:
+			return flags;
+	}
 }
 
-std::string disassembler::to_x(uint32_t x, unsigned bytes, char prefix) {
-	std::string s;
-	char buffer[16];
-	if (prefix) s.push_back(prefix);
 
-	if (x > 0xff && bytes < 4) bytes = 4;
-	if (x > 0xffff && bytes < 6) bytes = 6;
-	if (x > 0xffffff && bytes < 8) bytes = 8;
+unsigned decoder::size(uint8_t op, unsigned flags, unsigned traits) {
+	unsigned mode = modes[op];
+	if (traits & disassembler::pea_immediate && op == 0xf4) mode = 2 | mImmediate;
 
-	memset(buffer, '0', sizeof(buffer));
-	int i = 16;
-	while (x) {
-		buffer[--i] = "0123456789abcdef"[x & 0x0f];
-		x >>= 4;
-	}
+	unsigned size = mode & 0x0f;
+	if (mode & flags & m_I) size++;
+	if (mode & flags & m_M) size++;
+	return size + 1;
+}
 
-	s.append(buffer + 16 - bytes, buffer + 16);
+bool decoder::decode(const uint8_t *cp, size_t available, uint32_t pc, unsigned flags, unsigned traits, instruction &i) {
 
-	return s;
-}
+	if (!available) return false;
+
+	uint8_t op = cp[0];
+	unsigned n = size(op, flags, traits);
+	if (available < n) return false;
 
-int disassembler::operand_size(uint8_t op, bool m, bool x) {
 	unsigned mode = modes[op];
-	unsigned size = mode & 0x0f;
-	if ((mode & m_I) && x) size++; 
-	if ((mode & m_M) && m) size++;
-	return size;
+	if (traits & disassembler::pea_immediate && op == 0xf4) mode = 2 | mImmediate;
+
+	i.pc = pc;
+	i.opcode = op;
+	i.mode = mode & 0xff00;
+	i.size = n;
+	i.flags = flags & 0x30;
+	i.operand = 0;
+	for (unsigned j = n; --j; ) i.operand = (i.operand << 8) | cp[j];
+	return true;
 }
 
+bool decoder::next(instruction &i) {
+	if (!decode(_cp, _end - _cp, _pc, _flags, _traits, i)) return false;
 
-
-void disassembler::emit(const std::string &label) {
-	fputs(label.c_str(), stdout);
-	fputc('\n', stdout);
+	_cp += i.size;
+	_pc += i.size;
+	if (_traits & disassembler::track_rep_sep) _flags = i.next_flags();
+	return true;
 }
 
-void disassembler::emit(const std::string &label, const std::string &opcode) {
-	std::string tmp;
-	tmp = label;
 
-	if (!opcode.empty()) {
-		indent_to(tmp, kOpcodeTab);
-		tmp += opcode;
-	}
+constexpr const int kOpcodeTab = 20;
+constexpr const int kOperandTab = 30;
+constexpr const int kCommentTab = 80;
 
-	tmp.push_back('\n');
-	fputs(tmp.c_str(), stdout);
-}
 
+namespace {
 
+	// "00" .. "ff"
+	struct hex_table {
+		char pairs[512];
 
-void disassembler::emit(const std::string &label, const std::string &opcode, const std::string &operand) {
+		constexpr hex_table() : pairs() {
+			for (int i = 0; i < 256; ++i) {
+				pairs[i * 2 + 0] = "0123456789abcdef"[i >> 4];
+				pairs[i * 2 + 1] = "0123456789abcdef"[i & 0x0f];
+			}
+		}
+	};
 
-	std::string tmp;
-	tmp = label;
+	constexpr hex_table kHex;
 
+	/*
+	 * every line is formatted into this buffer, which is reused (so there's
+	 * no allocation once it's grown) and then handed to stdio, which keeps it
+	 * in order with everything else written to stdout.
+	 */
+	std::string line;
 
-	if (!opcode.empty()) {
-		indent_to(tmp, kOpcodeTab);
-		tmp += opcode;
+	void indent_to(std::string &line, unsigned position) {
+		if (line.length() < position)
+			line.append(position - line.length(), ' ');
 	}
 
-	if (!operand.empty()) {
-		indent_to(tmp, kOperandTab);
-		tmp += operand;
+	// digits hex digits, more if value doesn't fit (see to_x).
+	void append_x(std::string &line, uint32_t x, unsigned digits, char prefix = 0) {
+
+		if (prefix) line.push_back(prefix);
+
+		if (x > 0xff && digits < 4) digits = 4;
+		if (x > 0xffff && digits < 6) digits = 6;
+		if (x > 0xffffff && digits < 8) digits = 8;
+
+		// leading zeros (only possible if digits > 8)
+		if (digits > 8) {
+			line.append(digits - 8, '0');
+			digits = 8;
+		}
+
+		char buffer[8];
+		char *cp = buffer + 8;
+		for (unsigned i = 0; i < 4; ++i, x >>= 8) {
+			cp -= 2;
+			cp[0] = kHex.pairs[(x & 0xff) * 2 + 0];
+			cp[1] = kHex.pairs[(x & 0xff) * 2 + 1];
+		}
+		line.append(buffer + 8 - digits, digits);
 	}
 
-	tmp.push_back('\n');
-	fputs(tmp.c_str(), stdout);
+	void append_decimal(std::string &line, uint32_t x) {
+		char buffer[10];
+		char *cp = buffer + 10;
+		do {
+			*--cp = '0' + x % 10;
+			x /= 10;
+		} while (x);
+		line.append(cp, buffer + 10);
+	}
+
+	void end_line(std::string &line) {
+		line.push_back('\n');
+		fwrite(line.data(), 1, line.length(), stdout);
+		line.clear();
+	}
 }
 
 
+disassembler::~disassembler() {
+}
+
+std::string disassembler::to_x(uint32_t x, unsigned bytes, char prefix) {
+	std::string s;
+	append_x(s, x, bytes, prefix);
+	return s;
+}
+
+int disassembler::operand_size(uint8_t op, bool m, bool x) {
+	return decoder::size(op, (m ? 0x20 : 0) | (x ? 0x10 : 0)) - 1;
+}
+
+
+
+void disassembler::emit(const std::string &label) {
+	line = label;
+	end_line(line);
+}
+
+void disassembler::emit(const std::string &label, const std::string &opcode) {
+	emit(label, opcode, std::string(), std::string());
+}
+
+void disassembler::emit(const std::string &label, const std::string &opcode, const std::string &operand) {
+	emit(label, opcode, operand, std::string());
+}
+
 void disassembler::emit(const std::string &label, const std::string &opcode, const std::string &operand, const std::string &comment) {
 
-	std::string tmp;
-	tmp = label;
+	line = label;
 
 	if (!opcode.empty()) {
-		indent_to(tmp, kOpcodeTab);
-		tmp += opcode;
+		indent_to(line, kOpcodeTab);
+		line += opcode;
 	}
 
 	if (!operand.empty()) {
-		indent_to(tmp, kOperandTab);
-		tmp += operand;
+		indent_to(line, kOperandTab);
+		line += operand;
 	}
 
 	if (!comment.empty()) {
-		indent_to(tmp, kCommentTab);
-		tmp += "; ";
-		tmp += comment;	
+		indent_to(line, kCommentTab);
+		line += "; ";
+		line += comment;	
 	}
 
-	tmp.push_back('\n');
-	fputs(tmp.c_str(), stdout);
+	end_line(line);
 }
 
 
@@ -486,59 +544,34 @@ void disassembler::emit(const std::string &label, const std::string &opcode, con
 
 
 void disassembler::reset() {
-	_arg = 0;
 	_st = 0;
 }
 
 
-std::pair<std::string, std::string> 
-disassembler::format_data(unsigned size, const uint8_t *data) {
-
-	std::string tmp;
-
-	for (unsigned i = 0; i < size; ++i) {
-		if (i > 0) tmp += ", ";
-		tmp += to_x(data[i], 2, '$');
-	}
-
-	return std::make_pair("db", tmp);
-}
-
-std::pair<std::string, std::string> 
-disassembler::format_data(unsigned size, const std::string &data) {
-
+const char *disassembler::data_opcode(unsigned size) const {
 	switch(size) {
-		case 1: return std::make_pair("db", data);
-		case 2: return std::make_pair("dw", data);
-		case 3: return std::make_pair("da", data);
-		case 4: return std::make_pair("dl", data);
-
-		default: { 
-			std::string tmp;
-			tmp = std::to_string(size) + " bytes";
-			return std::make_pair(tmp, data);
-
-		}
+		case 1: return "db";
+		case 2: return "dw";
+		case 3: return "da";
+		case 4: return "dl";
+		default: return nullptr;
 	}
 }
 
 void disassembler::dump() {
 
-	std::string line;
-
 	if (!_st) return;
 
-
-	auto p = format_data(_st, _bytes);
-
 	indent_to(line, kOpcodeTab);
-	line += p.first;
+	line += data_opcode(1);
 	indent_to(line, kOperandTab);
-	line += p.second;
+	for (unsigned i = 0; i < _st; ++i) {
+		if (i > 0) line += ", ";
+		append_x(line, _bytes[i], 2, '$');
+	}
 
-	hexdump(line);
-	line.push_back('\n');
-	fputs(line.c_str(), stdout);
+	hexdump();
+	end_line(line);
 
 	_pc += _st;
 	reset();
@@ -546,25 +579,29 @@ void disassembler::dump() {
 
 void disassembler::dump(const std::string &expr, unsigned size, uint32_t value) {
 
-	std::string line;
-
-	if (_st) dump();
+	if (_st) {
+		// partial instruction. a label may start with the expression.
+		dump();
+		check_labels();
+	}
 
 	for (_st = 0; _st < size; ++_st) {
 		_bytes[_st] = value & 0xff;
 		value >>= 8;
 	}
 
-	auto p = format_data(size, expr);
-
 	indent_to(line, kOpcodeTab);
-	line += p.first;
+	if (const char *cp = data_opcode(size)) {
+		line += cp;
+	} else {
+		append_decimal(line, size);
+		line += " bytes";
+	}
 	indent_to(line, kOperandTab);
-	line += p.second;
+	line += expr;
 
-	hexdump(line);
-	line.push_back('\n');
-	fputs(line.c_str(), stdout);
+	hexdump();
+	end_line(line);
 
 	_pc += _st;
 	reset();
@@ -590,12 +627,7 @@ void disassembler::check_labels() {
 void disassembler::space(unsigned size) {
 	flush();
 
-	std::string line;
-
-	indent_to(line, kOpcodeTab);
-	line += ds();
-	indent_to(line, kOperandTab);
-
+	std::string opcode = ds();
 
 	while (size) {
 		uint32_t chunk;
@@ -605,15 +637,16 @@ void disassembler::space(unsigned size) {
 			chunk = std::min(chunk, size);
 		}
 
-		line.resize(kOperandTab);
-		line += std::to_string(chunk);
+		indent_to(line, kOpcodeTab);
+		line += opcode;
+		line.resize(kOperandTab, ' ');
+		append_decimal(line, chunk);
 		indent_to(line, kCommentTab);
 		line += "; ";
 
-		line += to_x(_pc, 4);
+		append_x(line, _pc, 4);
 		line.push_back(':');
-		line.push_back('\n');
-		fputs(line.c_str(), stdout);	
+		end_line(line);
 
 
 		_pc += chunk;
@@ -647,7 +680,10 @@ void disassembler::operator()(const std::string &expr, unsigned size, uint32_t v
 		_bytes[_st++] = value & 0xff;
 		value >>= 8;
 	}
-	print(expr);
+
+	instruction i;
+	decoder::decode(_bytes, _st, _pc, _flags, _traits, i);
+	print(i, expr);
 }
 
 
@@ -672,78 +708,50 @@ void disassembler::operator()(uint8_t byte) {
 
 	_bytes[_st++] = byte;
 	if (_st == 1) {
-		_op = byte;
-		_mode = modes[_op];
 
 		// bit hack
-		if (_traits & bit_hacks && _op == 0x2c) {
+		if (_traits & bit_hacks && byte == 0x2c) {
 			if (_next_label == _pc + 1) {
 				dump();
 				return;
 			}
 		}
 
-		if (_traits & pea_immediate && _op == 0xf4) _mode = 2 | mImmediate;
-		_size = _mode & 0x0f;
-		if (_mode & _flags & m_I) _size++;
-		if (_mode & _flags & m_M) _size++;
-
-		if (!_size) {
-			print();
-
-			if (branchlike(byte)) fputs("\n", stdout);
-		}
-		return;
+		_size = decoder::size(byte, _flags, _traits) - 1;
 	}
-	unsigned shift = (_st - 2) * 8;
-	_arg = _arg + (byte << shift);
 	if (_st <= _size) return;
 
-	uint8_t op = _op;
-	uint32_t arg = _arg;
+	// all done... now print it.
+	instruction i;
+	decoder::decode(_bytes, _st, _pc, _flags, _traits, i);
 
-	if (_traits & track_rep_sep) {
-		switch(_op) {
-			case 0xc2: // REP
-				_flags |= (_arg & 0x30);
-				break;
-			case 0xe2: // SEP
-				_flags &= ~(_arg & 0x30);
-				break;
-		}
-	}
+	if (_traits & track_rep_sep) _flags = i.next_flags();
 
-	// all done... now print it.
-	print();
+	print(i);
 
-	if (branchlike(op)) fputs("\n", stdout);
+	if (branchlike(i.opcode)) fputc('\n', stdout);
 
 	// todo -- subscribe to before/after events...
-	switch(op) {
+	switch(i.opcode) {
 		case 0xc2:
 		case 0xe2:
 		case 0x22:
 		case 0x5c:
 		case 0xdc:
-			event(op, arg);
+			event(i.opcode, i.operand);
 			break;
 	}
-
-
-
 }
 
 
-std::string disassembler::prefix() {
-
-	std::string tmp;
+void disassembler::prefix(const instruction &i) {
 
-	switch(_mode & 0xf000) {
-		case mImmediate: tmp = "#"; break;
-		case mDP: tmp = "<"; break;
-		case mDPI: tmp = "(<"; break;
-		case mDPIL: tmp = "[<"; break;
-		case mAbsoluteIL: tmp = "["; break;
+	switch(i.mode & 0xf000) {
+		case mImmediate: line += "#"; break;
+		case mDP: line += "<"; break;
+		case mDPI: line += "(<"; break;
+		case mDPIL: line += "[<"; break;
+		case mAbsoluteIL: line += "["; break;
 
 		case mRelative:
 		case mBlockMove:
@@ -751,65 +759,60 @@ std::string disassembler::prefix() {
 
 		// cop, brk are treated as absolute.
 		case mAbsolute: 
-			//if (_size == 1) printf("\t");
-			if (_size > 1) tmp = "|";
+			//if (i.size == 2) printf("\t");
+			if (i.size > 2) line += "|";
 			break;
-		case mAbsoluteLong: tmp = ">"; break;
-		case mAbsoluteI: tmp = "("; break;
+		case mAbsoluteLong: line += ">"; break;
+		case mAbsoluteI: line += "("; break;
 	}
-	return tmp;
 }
 
 
 
-std::string disassembler::suffix() {
+void disassembler::suffix(const instruction &i) {
 
-	std::string tmp;
-
-	switch(_mode & 0x0f00) {
-		case m_X: tmp = ",x"; break;
-		case m_Y: if (!(_mode & (mDPI|mDPIL))) tmp = ",y"; break;
+	switch(i.mode & 0x0f00) {
+		case m_X: line += ",x"; break;
+		case m_Y: if (!(i.mode & (mDPI|mDPIL))) line += ",y"; break;
 		case m_S:
 		case m_S | m_Y:
-			tmp = ",s"; break;
+			line += ",s"; break;
 	}
 
-	switch(_mode & 0xf000) {
+	switch(i.mode & 0xf000) {
 		case mAbsoluteI:
 		case mDPI:
-			tmp += ")"; break;
+			line += ")"; break;
 		case mAbsoluteIL:
 		case mDPIL:
-			tmp += "]"; break;
+			line += "]"; break;
 	}
 
 	// (xxx,s),y
 	// (xxx),y
 	// [xxx],y
-	switch(_mode & 0x0f00) {
+	switch(i.mode & 0x0f00) {
 		case m_Y:
-			if (_mode & (mDPI|mDPIL)) tmp += ",y"; break;
+			if (i.mode & (mDPI|mDPIL)) line += ",y"; break;
 		case m_S | m_Y:
-			tmp += ",y"; break;
+			line += ",y"; break;
 	}	
-	return tmp;
-
 }
 
 
-void disassembler::hexdump(std::string &line) {
+void disassembler::hexdump() {
 	// print pc and hexdump...
 
 	indent_to(line, kCommentTab);
 	line += "; ";
 
-	line += to_x(_pc, 4);
+	append_x(line, _pc, 4);
 	line.push_back(':');
 
 	int i;
 	for (i = 0; i < _st; ++i) {
 		line.push_back(' ');
-		line += to_x(_bytes[i], 2);
+		append_x(line, _bytes[i], 2);
 	}
 	for ( ; i < 4; ++i) {
 		line += "   ";
@@ -828,101 +831,89 @@ void disassembler::hexdump(std::string &line) {
 std::string disassembler::label_for_address(uint32_t address) { return ""; }
 std::string disassembler::label_for_zp(uint32_t address) { return ""; }
 
-void disassembler::print() {
-
+void disassembler::print(const instruction &i) {
 
-	if (_size) {
-		std::string tmp;
-
-		switch(_mode & 0xf000) {
-			case mRelative: {
+	indent_to(line, kOpcodeTab);
+	line.append(&opcodes[i.opcode * 3], 3);
 
-				uint32_t pc = _pc + 1 + _size + _arg;
+	if (i.size > 1) {
 
-				if ((_size == 1) && (_arg & 0x80))
-					pc += 0xff00;
-				pc &= 0xffff;
+		indent_to(line, kOperandTab);
+		prefix(i);
 
+		unsigned digits = i.operand_size() * 2;
+		switch(i.mode & 0xf000) {
+			case mRelative: {
+				uint32_t pc = i.target();
 
 				// it would be really fancy if it checked for a label name @pc...
-				tmp = label_for_address(pc);
-				if (tmp.empty()) tmp = to_x(pc, 4, '$');
+				std::string tmp = label_for_address((i.pc & 0xff0000) | pc);
+				if (tmp.empty()) append_x(line, pc, 4, '$');
+				else line += tmp;
 				break;
 			}
 			case mBlockMove: {
 				// todo -- verify order.
-				tmp = to_x((_arg >> 8) & 0xff, 2, '$')
-					+ ","
-					+ to_x((_arg >> 0) & 0xff, 2, '$');
+				append_x(line, (i.operand >> 8) & 0xff, 2, '$');
+				line.push_back(',');
+				append_x(line, (i.operand >> 0) & 0xff, 2, '$');
 				break;
 			}
 			case mDP:
 			case mDPI:
-			case mDPIL:
-				tmp = label_for_zp(_arg);
-				if (tmp.empty()) tmp = to_x(_arg, _size * 2, '$');
+			case mDPIL: {
+				std::string tmp = label_for_zp(i.operand);
+				if (tmp.empty()) append_x(line, i.operand, digits, '$');
+				else line += tmp;
 				break;
+			}
 
 			//case mImmediate:
 			case mAbsolute:
 			case mAbsoluteI:
 			case mAbsoluteIL:
-			case mAbsoluteLong:
-				tmp = label_for_address(_arg);
-				if (tmp.empty()) tmp = to_x(_arg, _size * 2, '$');
+			case mAbsoluteLong: {
+				std::string tmp = label_for_address(i.operand);
+				if (tmp.empty()) append_x(line, i.operand, digits, '$');
+				else line += tmp;
 				break;
+			}
 
 			default:
-				tmp = to_x(_arg, _size * 2, '$');
+				append_x(line, i.operand, digits, '$');
 				break;
 		}
-		print(tmp);
-		return;
-
-	}
-
-	std::string line;
-
-
 
+		suffix(i);
 
-	indent_to(line, kOpcodeTab);
-	line.append(&opcodes[_op * 3], 3);
-
-	if (_mode == mImpliedA && (_traits & explicit_implied_a)) {
+	} else if (i.mode == mImpliedA && (_traits & explicit_implied_a)) {
 		indent_to(line, kOperandTab);
 		line.append("a");
 	}
 
-
-	hexdump(line);
-	line.push_back('\n');
-	fputs(line.c_str(), stdout);
-	_pc += _size + 1;
+	hexdump();
+	end_line(line);
+	_pc += i.size;
 	reset();
 }
 
-void disassembler::print(const std::string &expr) {
-
-
-	std::string line;
+void disassembler::print(const instruction &i, const std::string &expr) {
 
 	indent_to(line, kOpcodeTab);
-	line.append(&opcodes[_op * 3], 3);
+	line.append(&opcodes[i.opcode * 3], 3);
 
-	if (_size) {
+	if (i.size > 1) {
 
 		indent_to(line, kOperandTab);
-		line += prefix();
+		prefix(i);
 		line += expr;
-		line += suffix();
+		suffix(i);
 	}
 
-	hexdump(line);
-	line.push_back('\n');
-	fputs(line.c_str(), stdout);
+	hexdump();
+	end_line(line);
 
-	_pc += _size + 1;
+	_pc += i.size;
 	reset();	
 }
 
@@ -933,6 +924,17 @@ const std::vector<uint32_t> &analyzer::finish() {
 	std::sort(_labels.begin(), _labels.end());
 	auto end = std::unique(_labels.begin(), _labels.end());
 	_labels.erase(end, _labels.end());
+
+	if (!std::is_sorted(_spans.begin(), _spans.end()))
+		std::sort(_spans.begin(), _spans.end());
+
+	end = std::remove_if(_labels.begin(), _labels.end(), [this](uint32_t pc){
+		auto iter = std::upper_bound(_spans.begin(), _spans.end(), std::make_pair(pc, ~0u));
+		if (iter == _spans.begin()) return false;
+		--iter;
+		return pc != iter->first && pc < iter->first + iter->second;
+	});
+	_labels.erase(end, _labels.end());
 	return _labels;
 }
 
@@ -950,64 +952,163 @@ void analyzer::operator()(uint8_t byte) {
 		return;
 	}
 
-	_st++;
-	if (_st == 1) {
-		_op = byte;
-		_mode = modes[_op];
+	_bytes[_st++] = byte;
+	if (_st == 1) _size = decoder::size(byte, _flags, _traits);
+	if (_st < _size) return;
+
+	// all done... now process it
+	process();
+}
 
-		_size = _mode & 0x0f;
-		if (_mode & _flags & m_I) _size++;
-		if (_mode & _flags & m_M) _size++;
+void analyzer::operator()(int32_t value, unsigned size) {
 
-		if (!_size) { reset(); }
+	if (!_code || _st != 1 || size + 1 != _size) {
+		// data (or a partial instruction, which the disassembler dumps as data).
+		if (value >= 0 && size >= 2) _labels.push_back(value);
+		if (_st) _spans.emplace_back(_pc, _st);
+		_spans.emplace_back(_pc + _st, size);
+		_pc += _st + size;
+		_st = 0;
 		return;
 	}
-	unsigned shift = (_st - 2) * 8;
-	_arg = _arg + (byte << shift);
-	if (_st <= _size) return;
 
+	uint32_t tmp = value;
+	for (unsigned i = 0; i < size; ++i, tmp >>= 8)
+		_bytes[_st++] = tmp;
 
-	// all done... now process it
-	process();
+	instruction i;
+	decoder::decode(_bytes, _st, _pc, _flags, _traits, i);
+	_spans.emplace_back(_pc, _st);
+
+	if (_traits & disassembler::track_rep_sep) _flags = i.next_flags();
+
+	if (value >= 0) {
+		switch (i.mode & 0xf000) {
+			case mRelative:
+			case mAbsolute:
+			case mAbsoluteI:
+			case mAbsoluteLong:
+				_labels.push_back(value);
+				break;
+		}
+	}
+	reset();
 }
 
 void analyzer::reset() {
 	_pc += _st;
-	_arg = 0;
 	_st = 0;
 }
 
 void analyzer::process() {
 
-	if (_traits & disassembler::track_rep_sep) {
-		switch(_op) {
-			case 0xc2: // REP
-				_flags |= (_arg & 0x30);
-				break;
-			case 0xe2: // SEP
-				_flags &= ~(_arg & 0x30);
-				break;
+	instruction i;
+	decoder::decode(_bytes, _st, _pc, _flags, _traits, i);
+	_spans.emplace_back(_pc, _st);
+
+	if (_traits & disassembler::track_rep_sep) _flags = i.next_flags();
+
+	switch (i.mode & 0xf000) {
+		case mRelative:
+			_labels.push_back((i.pc & 0xff0000) | i.target());
+			break;
+		case mAbsolute:
+		case mAbsoluteI:
+		case mAbsoluteLong:
+			if (_absolute) _labels.push_back(i.operand);
+			break;
+	}
+	reset();
+}
+
+
+#pragma mark -
+
+const std::vector<control_flow::block> &control_flow::run() {
+
+	std::sort(_references.begin(), _references.end());
+	_state.assign(_end - _begin, 0);
+	_blocks.clear();
+
+	// entry points in the order they were added.
+	std::reverse(_work.begin(), _work.end());
+	while (!_work.empty()) {
+		auto w = _work.back();
+		_work.pop_back();
+		walk(w.first, w.second);
+	}
+
+	for (size_t i = 0; i < _state.size(); ++i) {
+		uint8_t st = _state[i];
+		if (!(st & kStart)) continue;
+
+		uint32_t pc = _pc + i;
+		if (st & kLeader || _blocks.empty() || _blocks.back().end != pc) {
+			block b;
+			b.pc = pc;
+			b.flags = st & 0x30;
+			_blocks.push_back(b);
 		}
+		auto &b = _blocks.back();
+		if (st & kConflict) b.conflict = true;
+		b.end = pc + decoder::size(_begin[i], st & 0x30, _traits);
 	}
+	return _blocks;
+}
 
-	switch (_mode & 0xf000) {
-		case mRelative: {
+int32_t control_flow::reference(uint32_t pc) const {
+	auto iter = std::lower_bound(_references.begin(), _references.end(), std::make_pair(pc, 0u));
+	if (iter == _references.end() || iter->first != pc) return -1;
+	return iter->second;
+}
 
-			uint32_t pc = _pc + 1 + _size + _arg;
+void control_flow::walk(uint32_t pc, unsigned flags) {
 
-			if ((_size == 1) && (_arg & 0x80))
-				pc += 0xff00;
-			pc &= 0xffff;
+	bool leader = true;
+	for(;;) {
+		if (pc < _pc || pc - _pc >= _state.size()) return;
 
-			_labels.push_back(pc);
-			break;
+		size_t offset = pc - _pc;
+		uint8_t &st = _state[offset];
+
+		if (st & kInside) return; // overlapping instructions
+
+		if (st & kStart) {
+			// been here before.
+			st |= kLeader;
+			if ((st & 0x30) != flags) st |= kConflict;
+			return;
 		}
-		case mAbsolute:
-		case mAbsoluteI:
-		case mAbsoluteLong: {
-			_labels.push_back(_arg);
-			break;
+
+		instruction i;
+		if (!decoder::decode(_begin + offset, _state.size() - offset, pc, flags, _traits, i)) return;
+		for (unsigned j = 1; j < i.size; ++j)
+			if (_state[offset + j]) return;
+
+		st = kStart | flags | (leader ? kLeader : 0);
+		for (unsigned j = 1; j < i.size; ++j) _state[offset + j] = kInside;
+
+		uint8_t op = i.opcode;
+		bool relative = (i.mode & 0xf000) == mRelative;
+		int32_t target = -1;
+
+		if (relative) target = (pc & 0xff0000) | i.target();
+		switch (op) {
+			case 0x20: // jsr
+			case 0x22: // jsl
+			case 0x4c: // jmp
+			case 0x5c: // jml
+				target = reference(pc + 1);
+				break;
 		}
+
+		flags = i.next_flags();
+		if (target >= 0) _work.emplace_back(target, flags);
+
+		if (branchlike(op) && !(relative && op != 0x80 && op != 0x82)) return;
+		if (op == 0x00 || op == 0xdb) return; // brk, stp
+
+		pc += i.size;
+		leader = relative;
 	}
-	reset();
 }
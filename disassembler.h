@@ -2,8 +2,61 @@
 #define __disassembler_h__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <string>
 #include <vector>
+#include <iterator>
+#include <utility>
+
+// addressing modes (instruction::mode)
+enum {
+	mImplied =      0x0000,
+	mImmediate =    0x1000,
+	mAbsolute =     0x2000,
+	mAbsoluteI =    0x3000,
+	mAbsoluteIL =   0x4000,
+	mAbsoluteLong = 0x5000,
+	mDP =           0x6000,
+	mDPI =          0x7000,
+	mDPIL =         0x8000,
+	mRelative =     0x9000,
+	mBlockMove =    0xa000,
+	mImpliedA =     0xb000, // inc a, dec a, etc.
+
+	// index
+	m_S =           0x0100,
+	m_X =           0x0200,
+	m_Y =           0x0400,
+
+	// operand size depends on m/x (opcode table only)
+	m_M =           0x0020,
+	m_I =           0x0010,
+};
+
+/*
+ * one decoded instruction. flags is the m/x state ($20/$10 of p) it was
+ * decoded with.
+ */
+struct instruction {
+	uint32_t pc = 0;
+	uint32_t operand = 0;
+	uint16_t mode = 0; // mode | index
+	uint8_t opcode = 0;
+	uint8_t size = 0; // including the opcode
+	uint8_t flags = 0x30;
+
+	bool m() const { return flags & 0x20; }
+	bool x() const { return flags & 0x10; }
+
+	unsigned operand_size() const { return size - 1; }
+
+	// mRelative branch target (16-bit, like the printed operand).
+	uint32_t target() const;
+
+	// p after rep/sep.
+	uint8_t next_flags() const;
+};
+
 
 // disassembler traits
 
@@ -84,8 +137,8 @@ class disassembler {
 	protected:
 
 
-		virtual std::pair<std::string, std::string> format_data(unsigned size, const uint8_t *data);
-		virtual std::pair<std::string, std::string> format_data(unsigned size, const std::string &);
+		// db, dw, etc. nullptr for "n bytes".
+		virtual const char *data_opcode(unsigned size) const;
 
 		virtual std::string label_for_address(uint32_t address);
 		virtual std::string label_for_zp(uint32_t address);
@@ -114,22 +167,20 @@ class disassembler {
 		void dump();
 		void dump(const std::string &expr, unsigned size, uint32_t value = 0);
 
-		void print();
-		void print(const std::string &expr);
+		void print(const instruction &);
+		void print(const instruction &, const std::string &expr);
 
-		std::string prefix();
-		std::string suffix();
+		// these append to the current line.
+		void prefix(const instruction &);
+		void suffix(const instruction &);
 
-		void hexdump(std::string &);
+		void hexdump();
 
 		unsigned _st = 0;
-		uint8_t _op = 0;
-		unsigned _size = 0;
-		unsigned _mode = 0;
+		unsigned _size = 0; // operand bytes
 		uint8_t _bytes[4];
 		unsigned _flags = 0x30;
 		unsigned _pc = 0;
-		unsigned _arg = 0;
 
 		bool _code = true;
 		int _inline_data = 0;
@@ -140,6 +191,94 @@ class disassembler {
 		void check_labels();
 };
 
+/*
+ * pulls instructions from a span of bytes, without formatting anything:
+ *
+ *   for (const instruction &i : decoder(begin, end, pc)) ...
+ *
+ * stops at the end or before an incomplete instruction (see offset()).
+ * traits are the disassembler traits; pea_immediate and track_rep_sep apply.
+ */
+class decoder {
+
+public:
+
+	class iterator;
+
+	decoder(const uint8_t *begin, const uint8_t *end, uint32_t pc = 0, unsigned traits = 0) :
+		_begin(begin), _cp(begin), _end(end), _pc(pc), _traits(traits)
+	{}
+
+	bool next(instruction &);
+
+	iterator begin();
+	iterator end();
+
+	size_t offset() const { return _cp - _begin; }
+	uint32_t pc() const { return _pc; }
+
+	bool m() const { return _flags & 0x20; }
+	bool x() const { return _flags & 0x10; }
+
+	void set_m(bool x) {
+		if (x) _flags |= 0x20;
+		else _flags &= ~0x20;
+	}
+
+	void set_x(bool x) {
+		if (x) _flags |= 0x10;
+		else _flags &= ~0x10;
+	}
+
+	// instruction size (including the opcode) for op.
+	static unsigned size(uint8_t op, unsigned flags, unsigned traits = 0);
+
+	// false if there are fewer than size() bytes.
+	static bool decode(const uint8_t *cp, size_t available, uint32_t pc, unsigned flags, unsigned traits, instruction &);
+
+private:
+
+	const uint8_t *_begin;
+	const uint8_t *_cp;
+	const uint8_t *_end;
+	uint32_t _pc;
+	unsigned _traits;
+	unsigned _flags = 0x30;
+};
+
+class decoder::iterator {
+
+public:
+
+	typedef std::input_iterator_tag iterator_category;
+	typedef instruction value_type;
+	typedef ptrdiff_t difference_type;
+	typedef const instruction *pointer;
+	typedef const instruction &reference;
+
+	iterator() = default;
+	explicit iterator(decoder *d) : _d(d) { ++*this; }
+
+	reference operator*() const { return _i; }
+	pointer operator->() const { return &_i; }
+
+	iterator &operator++() {
+		if (_d && !_d->next(_i)) _d = nullptr;
+		return *this;
+	}
+
+	bool operator==(const iterator &rhs) const { return _d == rhs._d; }
+	bool operator!=(const iterator &rhs) const { return _d != rhs._d; }
+
+private:
+	decoder *_d = nullptr;
+	instruction _i;
+};
+
+inline decoder::iterator decoder::begin() { return iterator(this); }
+inline decoder::iterator decoder::end() { return iterator(); }
+
+
 class analyzer {
 
 public:
@@ -150,6 +289,15 @@ public:
 	void set_pc(uint32_t pc) { _pc = pc; }
 	uint32_t pc() const { return _pc; }
 
+	// drop a partial instruction (like disassembler::flush, which dumps it as data).
+	void flush() {
+		if (_st) _spans.emplace_back(_pc, _st);
+		reset();
+	}
+
+	// raw absolute operands are addresses in this section (not relocatable code).
+	void set_absolute(bool absolute) { _absolute = absolute; }
+
 
 	bool m() const { return _flags & 0x20; }
 	bool x() const { return _flags & 0x10; }
@@ -167,9 +315,12 @@ public:
 
 
 	void operator()(uint8_t x);
-	void operator()(uint32_t x, unsigned size);
+
+	// an expression. value is the location it refers to, or -1.
+	void operator()(int32_t value, unsigned size);
 
 
+	// sorted targets, less any that land inside an instruction or data item.
 	const std::vector<uint32_t> &finish();
 
 	bool state() const { return _st == 0; }
@@ -182,15 +333,88 @@ private:
 	unsigned _traits = 0;
 	int _inline_data = 0;
 	bool _code = true;
+	bool _absolute = true;
 	unsigned _st = 0;
-	uint8_t _op = 0;
-	unsigned _size = 0;
+	unsigned _size = 0; // including the opcode
+	uint8_t _bytes[4];
 	unsigned _flags = 0x30;
 	unsigned _pc = 0;
-	unsigned _arg = 0;
-	unsigned _mode = 0;
 
 	std::vector<uint32_t> _labels;
+	std::vector< std::pair<uint32_t, uint32_t> > _spans; // pc, size of each instruction or data item
+};
+
+
+/*
+ * infers m/x for a span of code by following control flow instead of
+ * reading it linearly.
+ *
+ * starting from the entry points, run() decodes each path up to a branch
+ * (see branchlike()), queues the targets with the m/x state after rep/sep,
+ * and splits the code into basic blocks. a block reached with different
+ * states is flagged as a conflict and keeps the first one. calls are assumed
+ * to return with m/x unchanged.
+ *
+ * bytes that aren't reached (data, code only called from elsewhere) aren't
+ * in any block.
+ */
+class control_flow {
+
+public:
+
+	struct block {
+		uint32_t pc = 0;
+		uint32_t end = 0; // after the last instruction
+		uint8_t flags = 0x30; // m/x on entry
+		bool conflict = false;
+
+		bool m() const { return flags & 0x20; }
+		bool x() const { return flags & 0x10; }
+	};
+
+	control_flow(const uint8_t *begin, const uint8_t *end, uint32_t pc = 0, unsigned traits = 0) :
+		_begin(begin), _end(end), _pc(pc), _traits(traits)
+	{}
+
+	void add_entry(uint32_t pc, unsigned flags = 0x30) { _work.emplace_back(pc, flags & 0x30); }
+
+	// the operand at pc refers to target (a relocated jmp, jsr, etc).
+	void add_reference(uint32_t pc, uint32_t target) { _references.emplace_back(pc, target); }
+
+	// blocks, sorted by pc.
+	const std::vector<block> &run();
+
+	const std::vector<block> &blocks() const { return _blocks; }
+
+	// m/x of the reached instruction starting at pc, or -1 (after run()).
+	int flags(uint32_t pc) const {
+		if (pc < _pc || pc - _pc >= _state.size()) return -1;
+		uint8_t st = _state[pc - _pc];
+		return st & kStart ? st & 0x30 : -1;
+	}
+
+private:
+
+	// per byte state, | m/x for instructions.
+	enum {
+		kStart = 0x01,
+		kInside = 0x02,
+		kLeader = 0x04,
+		kConflict = 0x08,
+	};
+
+	void walk(uint32_t pc, unsigned flags);
+	int32_t reference(uint32_t pc) const;
+
+	const uint8_t *_begin;
+	const uint8_t *_end;
+	uint32_t _pc;
+	unsigned _traits;
+
+	std::vector<uint8_t> _state;
+	std::vector< std::pair<uint32_t, unsigned> > _work;
+	std::vector< std::pair<uint32_t, uint32_t> > _references;
+	std::vector<block> _blocks;
 };
 
 #endif
@@ -12,6 +12,7 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <memory>
 
 #include "obj816.h"
 #include "zrdz_disassembler.h"
@@ -181,6 +182,400 @@ std::vector<symbol> read_symbols(const std::vector<uint8_t> &symbol_data) {
 	return symbols;
 }
 
+/*
+ * the record stream, decoded.  both passes (find_targets and dump_obj) read
+ * it with read_record() so they can't disagree about the format.
+ */
+
+typedef std::vector<uint8_t>::const_iterator record_iterator;
+
+struct term {
+	uint8_t op = OP_END;
+	uint8_t section = 0; // OP_LOC
+	uint32_t value = 0; // OP_LOC offset, OP_VAL value, OP_SYM symbol
+};
+
+struct debug_op {
+	uint8_t op = 0;
+	std::string name; // D_C_FILE, D_C_STAG/ETAG/UTAG, D_C_SYM/MEMBER
+	uint8_t version = 0; // D_C_SYM/MEMBER: value is a symbol (0) or a number (1)
+	uint32_t value = 0;
+	uint32_t type = 0;
+	uint8_t klass = 0;
+	std::vector<uint16_t> args; // the remaining 16-bit fields, in order
+};
+
+struct record {
+	uint8_t op = REC_END;
+	record_iterator begin, end; // data (op < 0xf0)
+	uint8_t size = 0; // REC_EXPR, REC_RELEXP
+	std::vector<term> expr; // ... in stack order
+	std::vector<debug_op> debug; // REC_DEBUG
+	uint32_t value = 0; // REC_SECT, REC_ORG, REC_SPACE
+};
+
+
+debug_op read_debug_op(const char *name, record_iterator &iter) {
+	debug_op d;
+	d.op = read_8(iter);
+	switch(d.op) {
+		case D_LONGA_ON:
+		case D_LONGA_OFF:
+		case D_LONGI_ON:
+		case D_LONGI_OFF:
+		case D_C_EOS:
+			break;
+
+		case D_C_FILE:
+			d.name = read_cstring(iter);
+			d.args.push_back(read_16(iter)); // line
+			break;
+
+		case D_C_LINE:
+		case D_C_BLOCK:
+		case D_C_ENDBLOCK:
+		case D_C_FUNC:
+			d.args.push_back(read_16(iter));
+			break;
+
+		case D_C_ENDFUNC:
+			// line, local offset, arg offset
+			for (int i = 0; i < 3; ++i) d.args.push_back(read_16(iter));
+			break;
+
+		// etag? reserved for enums but not actually used?
+		case D_C_STAG:
+		case D_C_ETAG:
+		case D_C_UTAG:
+			d.name = read_cstring(iter);
+			d.args.push_back(read_16(iter)); // size
+			d.args.push_back(read_16(iter)); // tag
+			break;
+
+		case D_C_MEMBER:
+		case D_C_SYM: {
+			// warning - i don't fully understand this one..
+			d.name = read_cstring(iter);
+			d.version = read_8(iter); //???
+			if (d.version == 0) d.value = read_16(iter); // symbol
+			if (d.version == 1) d.value = read_32(iter); // numeric value.
+			assert(d.version == 0 || d.version == 1);
+			d.type = read_32(iter);
+			d.klass = read_8(iter);
+			d.args.push_back(read_16(iter)); // size
+
+			/*
+			 * type bits 1 ... 5 are T_xxxx
+			 * then 3 bits of DT_xxx (repeatedly)
+			 *
+			 * eg, char ** = (DT_PTR << 11) + (DT_PTR << 8) + T_CHAR
+			 */
+			int t = d.type & 0x1f;
+			if ((t == T_STRUCT) || (t == T_UNION)) d.args.push_back(read_16(iter)); // tag
+
+			// need to do it until t == 0 for
+			// multidimensional arrays.
+			for (t = d.type >> 5; t; t >>= 3) {
+				if ((t & 0x07) == DT_ARY) d.args.push_back(read_16(iter)); // dimension
+			}
+			break;
+		}
+
+		default:
+			errx(EX_DATAERR, "%s: unknown debug opcode %02x (%d)", name, d.op, d.op);
+	}
+	return d;
+}
+
+
+// false at REC_END.
+bool read_record(const char *name, record_iterator &iter, record &r) {
+
+	r.op = read_8(iter);
+	if (r.op == REC_END) return false;
+
+	if (r.op < 0xf0) {
+		r.begin = iter;
+		r.end = iter + r.op;
+		iter = r.end;
+		return true;
+	}
+
+	switch(r.op) {
+		case REC_RELEXP:
+		case REC_EXPR:
+			r.size = read_8(iter);
+			r.expr.clear();
+			for(;;) {
+				term t;
+				t.op = read_8(iter);
+				if (t.op == OP_END) break;
+				switch(t.op) {
+					case OP_LOC:
+						t.section = read_8(iter);
+						t.value = read_32(iter);
+						break;
+					case OP_VAL:
+						t.value = read_32(iter);
+						break;
+					case OP_SYM:
+						t.value = read_16(iter);
+						break;
+					default:
+						if (t.op >= OP_NOT && t.op <= OP_FLP) break;
+						if (t.op >= OP_EXP && t.op < OP_LAST) break;
+						errx(EX_DATAERR, "%s: unknown expression opcode %02x", name, t.op);
+				}
+				r.expr.push_back(t);
+			}
+			break;
+
+		case REC_DEBUG: {
+			uint16_t size = read_16(iter);
+			auto end = iter + size;
+			r.debug.clear();
+			while (iter < end) r.debug.emplace_back(read_debug_op(name, iter));
+			break;
+		}
+
+		case REC_SECT:
+			r.value = read_8(iter);
+			break;
+
+		case REC_ORG:
+			r.value = read_32(iter);
+			break;
+
+		case REC_SPACE:
+			r.value = read_16(iter);
+			break;
+
+		case REC_LINE:
+			// bump line counter, no argument.
+			break;
+
+		default:
+			errx(EX_DATAERR, "%s: unknown opcode %02x", name, r.op);
+	}
+	return true;
+}
+
+
+/*
+ * m/x for code sections that have no longa/longi records (modules that only
+ * use rep/sep), inferred by following branches and calls from the start of
+ * the section and its global symbols.  sections with longa/longi (or an org)
+ * are decoded linearly, as before.
+ */
+struct inferred_modes {
+	std::vector< std::unique_ptr<control_flow> > flow; // by section
+
+	bool inferred(unsigned section) const { return section < flow.size() && flow[section]; }
+
+	// m/x for the instruction at pc, or -1.
+	int flags(unsigned section, uint32_t pc) const {
+		if (!inferred(section)) return -1;
+		return flow[section]->flags(pc);
+	}
+
+	// switch to the inferred m/x at pc (a block may start mid-instruction).
+	template<class T>
+	bool apply(T &t, unsigned section, uint32_t pc) const {
+		int f = flags(section, pc);
+		if (f < 0) return false;
+		t.flush();
+		t.set_m(f & 0x20);
+		t.set_x(f & 0x10);
+		return true;
+	}
+};
+
+inferred_modes infer_modes(const char *name, const std::vector<uint8_t> &data, const std::vector<section> &sections, const std::vector<symbol> &symbols) {
+
+	unsigned count = SECT_UDATA + 1;
+	for (const auto &s : sections) count = std::max(count, s.number + 1u);
+
+	std::vector<bool> infer(count, false);
+	std::vector<uint32_t> org(count, 0);
+	std::vector< std::vector<uint8_t> > image(count);
+	std::vector< std::vector< std::pair<uint32_t, uint32_t> > > references(count);
+	for (const auto &s : sections) {
+		infer[s.number] = (s.flags & SEC_DATA) == 0;
+		org[s.number] = s.org;
+	}
+
+	unsigned sec = SECT_CODE;
+
+	record r;
+	auto iter = data.cbegin();
+	while (iter != data.cend() && read_record(name, iter, r)) {
+
+		auto &im = image[sec];
+		if (r.op < 0xf0) {
+			im.insert(im.end(), r.begin, r.end);
+			continue;
+		}
+
+		switch(r.op) {
+			case REC_RELEXP:
+			case REC_EXPR:
+				if (r.expr.size() == 1 && r.expr[0].op == OP_LOC && r.expr[0].section == sec)
+					references[sec].emplace_back(org[sec] + im.size(), r.expr[0].value);
+				im.insert(im.end(), r.size, 0);
+				break;
+
+			case REC_DEBUG:
+				for (const auto &op : r.debug) {
+					if (op.op >= D_LONGA_ON && op.op <= D_LONGI_OFF) infer[sec] = false;
+				}
+				break;
+
+			case REC_SECT:
+				if (r.value >= count) return inferred_modes();
+				sec = r.value;
+				break;
+
+			case REC_ORG:
+				infer[sec] = false;
+				break;
+
+			case REC_SPACE:
+				im.insert(im.end(), r.value, 0);
+				break;
+		}
+	}
+
+	inferred_modes rv;
+	rv.flow.resize(count);
+	for (unsigned i = 0; i < count; ++i) {
+		if (!infer[i] || image[i].empty()) continue;
+
+		const auto &im = image[i];
+		std::unique_ptr<control_flow> cf(new control_flow(im.data(), im.data() + im.size(), org[i], disassembler::wdc));
+
+		cf->add_entry(org[i]);
+		for (const auto &s : symbols) {
+			if (s.section != i || (s.type & 0x0f) != S_REL || !(s.flags & SF_GBL)) continue;
+			cf->add_entry(s.offset);
+		}
+		for (const auto &ref : references[i]) cf->add_reference(ref.first, ref.second);
+
+		for (const auto &b : cf->run()) {
+			if (b.conflict)
+				warnx("%s: section %u: conflicting m/x states at $%04x", name, i, b.pc);
+		}
+		rv.flow[i] = std::move(cf);
+	}
+	return rv;
+}
+
+
+/*
+ * first pass: run the analyzer over the code sections to find branch and
+ * jump targets, so the disassembly can give them labels. m/x is shared between
+ * sections, as it is in the disassembler.
+ */
+void find_targets(const char *name, const std::vector<uint8_t> &data, const std::vector<section> &sections, const inferred_modes &modes, zrdz_disassembler &d) {
+
+	unsigned count = SECT_UDATA + 1;
+	for (const auto &s : sections) count = std::max(count, s.number + 1u);
+
+	std::vector<analyzer> a(count, analyzer(disassembler::wdc));
+	std::vector<bool> code(count, true);
+	std::vector<uint32_t> pc(count, 0);
+	for (const auto &s : sections) {
+		a[s.number].set_pc(s.org);
+		a[s.number].set_absolute(s.flags & SEC_OFFSET);
+		code[s.number] = (s.flags & SEC_DATA) == 0;
+		pc[s.number] = s.org;
+	}
+
+	bool m = true;
+	bool x = true;
+	unsigned sec = SECT_CODE;
+
+	record r;
+	auto iter = data.cbegin();
+	while (iter != data.cend() && read_record(name, iter, r)) {
+
+		if (r.op < 0xf0) {
+			if (code[sec]) {
+				for (auto i = r.begin; i != r.end; ++i) {
+					if (modes.apply(a[sec], sec, pc[sec]++)) {
+						// the disassembler carries it into the next section.
+						m = a[sec].m();
+						x = a[sec].x();
+					}
+					a[sec](*i);
+				}
+			} else {
+				pc[sec] += r.end - r.begin;
+			}
+			continue;
+		}
+
+		switch(r.op) {
+			case REC_RELEXP:
+			case REC_EXPR: {
+				// only a lone OP_LOC in this section is a target.
+				int32_t value = -1;
+				if (r.expr.size() == 1 && r.expr[0].op == OP_LOC && r.expr[0].section == sec)
+					value = r.expr[0].value;
+				if (code[sec]) a[sec](value, r.size);
+				pc[sec] += r.size;
+				break;
+			}
+
+			case REC_DEBUG:
+				a[sec].flush();
+				for (const auto &op : r.debug) {
+					switch(op.op) {
+						case D_LONGA_ON: m = true; break;
+						case D_LONGA_OFF: m = false; break;
+						case D_LONGI_ON: x = true; break;
+						case D_LONGI_OFF: x = false; break;
+					}
+				}
+				a[sec].set_m(m);
+				a[sec].set_x(x);
+				break;
+
+			case REC_SECT:
+				if (r.value >= count) return; // dump_obj will complain.
+				if (r.value != sec) {
+					a[sec].flush();
+					sec = r.value;
+					a[sec].set_m(m);
+					a[sec].set_x(x);
+				}
+				break;
+
+			case REC_ORG:
+				a[sec].flush();
+				a[sec].set_pc(r.value);
+				pc[sec] = r.value;
+				break;
+
+			case REC_SPACE:
+				a[sec].flush();
+				a[sec].set_pc(a[sec].pc() + r.value);
+				pc[sec] += r.value;
+				break;
+
+			case REC_LINE:
+				a[sec].flush();
+				break;
+		}
+	}
+
+	for (unsigned i = 0; i < a.size(); ++i) {
+		if (!code[i]) continue;
+		const auto &targets = a[i].finish();
+		if (!targets.empty()) d.add_targets(i, targets);
+	}
+}
+
+
 bool dump_obj(const char *name, int fd)
 {
 	Mod_head h;
@@ -238,29 +633,60 @@ bool dump_obj(const char *name, int fd)
 	if (h.h_optsize) lseek(fd, h.h_optsize, SEEK_CUR);
 
 
-	zrdz_disassembler d(read_sections(section_data), read_symbols(symbol_data));
+	std::vector<section> sections = read_sections(section_data);
+	std::vector<symbol> symbols = read_symbols(symbol_data);
+
+	inferred_modes modes = infer_modes(name, data, sections, symbols);
+
+	zrdz_disassembler d(std::vector<section>(sections), std::move(symbols));
+
+	find_targets(name, data, sections, modes, d);
+
+	// next pc in each section, for the inferred modes.
+	std::vector<uint32_t> pc(modes.flow.size(), 0);
+	for (const auto &s : sections) {
+		if (s.number < pc.size()) pc[s.number] = s.org;
+	}
+	unsigned sec = SECT_CODE;
+	auto advance = [&](uint32_t n) { if (sec < pc.size()) pc[sec] += n; };
 
-	uint8_t op = REC_END;
 	unsigned line = 0;
 
 
 	d.front_matter(std::string(oname.data()));
 
-	auto iter = data.begin();
-	while (iter != data.end()) {
+	record r;
+	auto iter = data.cbegin();
+	while (iter != data.cend()) {
 
+		if (!read_record(name, iter, r)) break;
 
-		op = read_8(iter);
-		if (op == 0) break;
-		if (op < 0xf0) {
-			auto end = iter + op;
-			while (iter != end) {
-				d(*iter++);
+		if (r.op < 0xf0) {
+			if (!modes.inferred(sec)) {
+				d(r.begin, r.end);
+				advance(r.end - r.begin);
+				continue;
+			}
+			// as apply(), but with longa/longi so the output reassembles.
+			for (auto i = r.begin; i != r.end; ++i) {
+				int f = modes.flags(sec, pc[sec]++);
+				if (f >= 0) {
+					d.flush();
+					if (d.m() != !!(f & 0x20)) {
+						d.set_m(f & 0x20);
+						d.emit("", "longa", d.m() ? "on" : "off");
+					}
+					if (d.x() != !!(f & 0x10)) {
+						d.set_x(f & 0x10);
+						d.emit("", "longi", d.x() ? "on" : "off");
+					}
+				}
+				d(*i);
 			}
 			continue;
 		}
 
-		switch(op) {
+		switch(r.op) {
 
 			case REC_RELEXP:
 			case REC_EXPR:
@@ -269,42 +695,31 @@ bool dump_obj(const char *name, int fd)
 					// todo -- pass the relative flag to ()
 					// so it can verify it's appropriate for the opcode.
 
-					// todo -- move all this stuff to a separate function.
-					uint8_t size = read_8(iter);
-
 					std::vector<std::string> stack;
 
 					// todo -- need to keep operation for precedence?
 					// this ignores all precedence...
 
-					for(;;) {
-						uint8_t op = read_8(iter);
-						if (op == OP_END) break;
-						switch (op) {
+					for (const auto &t : r.expr) {
+						switch (t.op) {
 							case OP_LOC: {
-								uint8_t section = read_8(iter);
-								uint32_t offset = read_32(iter);
-
-
 								std::string name;
 								if (flags.n) {
-									name = d.section_name(section) + "+" + d.to_x(offset, 4, '$');
+									name = d.section_name(t.section) + "+" + d.to_x(t.value, 4, '$');
 								} else {
-									name = d.location_name(section, offset);
+									name = d.location_name(t.section, t.value);
 								}
 								stack.emplace_back(std::move(name));
 								break;
 							}
 
 							case OP_VAL:
-								stack.push_back(d.to_x(read_32(iter), 4, '$'));
+								stack.push_back(d.to_x(t.value, 4, '$'));
 								break;
 
-							case OP_SYM: {
-								uint16_t symbol = read_16(iter);
-								stack.emplace_back(d.symbol_name(symbol));
+							case OP_SYM:
+								stack.emplace_back(d.symbol_name(t.value));
 								break;
-							}
 
 							// unary operatos
 							case OP_NOT:
@@ -316,28 +731,13 @@ bool dump_obj(const char *name, int fd)
 
 								if (stack.empty()) errx(EX_DATAERR, "%s : stack underflow error", name);
 								std::string a = std::move(stack.back()); stack.pop_back();
-								std::string b(ops[op-10]);
+								std::string b(ops[t.op-10]);
 								stack.emplace_back(b + a);
 								break;
 							}
 
 							// binary operators
-							case OP_EXP:
-							case OP_MUL:
-							case OP_DIV:
-							case OP_MOD:
-							case OP_SHR:
-							case OP_SHL:
-							case OP_ADD:
-							case OP_SUB:
-							case OP_AND:
-							case OP_OR:
-							case OP_XOR:
-							case OP_EQ:
-							case OP_GT:
-							case OP_LT:
-							case OP_UGT:
-							case OP_ULT: {
+							default: {
 								static const std::string ops[] = {
 									"**", "*", "/", ".MOD.", ">>", "<<", "+", "-", "&", "|", "^", "=", ">", "<", ".UGT.", ".ULT."
 
@@ -345,28 +745,22 @@ bool dump_obj(const char *name, int fd)
 								if (stack.size() < 2) errx(EX_DATAERR, "%s : stack underflow error", name);
 								std::string a = std::move(stack.back()); stack.pop_back();
 								std::string b = std::move(stack.back()); stack.pop_back();
-								stack.emplace_back(b + ops[op-20] + a);
+								stack.emplace_back(b + ops[t.op-20] + a);
 								break;
 							}
-							default:
-								errx(EX_DATAERR, "%s: unknown expression opcode %02x", name, op);
-
 						}
 					}
 					if (stack.size() != 1) errx(EX_DATAERR, "%s stack overflow error.", name);
-					d(stack.front(), size);
+					d(stack.front(), r.size);
+					advance(r.size);
 				}
 				break;
 
 			case REC_DEBUG:
 				{
 					d.flush();
-					uint16_t size = read_16(iter);
-
-					auto end = iter + size;
-					while (iter < end) {
-						uint8_t op = read_8(iter);
-						switch(op) {
+					for (const auto &op : r.debug) {
+						switch(op.op) {
 							case D_LONGA_ON:
 								d.set_m(true);
 								d.emit("", "longa", "on");
@@ -384,57 +778,42 @@ bool dump_obj(const char *name, int fd)
 								d.emit("", "longi", "off");
 								break;
 							case D_C_FILE: {
-								std::string file = read_cstring(iter);
-								line = read_16(iter);
-								std::string tmp = file + ", " + std::to_string(line);
+								line = op.args[0];
+								std::string tmp = op.name + ", " + std::to_string(line);
 								d.emit("", ".file", tmp);
 								break;
 							}
 							case D_C_LINE: {
-								line = read_16(iter);
+								line = op.args[0];
 								d.emit("",".line", std::to_string(line));
 								break;
 							}
-							case D_C_BLOCK: {
-								uint16_t block = read_16(iter);
-								d.emit("",".block", std::to_string(block));
+							case D_C_BLOCK:
+								d.emit("",".block", std::to_string(op.args[0]));
 								break;
-							}
-							case D_C_ENDBLOCK: {
-								uint16_t block = read_16(iter);
-								d.emit("",".endblock", std::to_string(block));
+							case D_C_ENDBLOCK:
+								d.emit("",".endblock", std::to_string(op.args[0]));
+								break;
+							case D_C_FUNC:
+								d.emit("",".function", std::to_string(op.args[0]));
 								break;
-							}
-							case D_C_FUNC: {
-								uint16_t arg = read_16(iter);
-								d.emit("",".function", std::to_string(arg));
-								break;								
-							}
 							case D_C_ENDFUNC: {
-								uint16_t line = read_16(iter);
-								uint16_t local_offset = read_16(iter);
-								uint16_t arg_offset = read_16(iter);
 								std::string tmp;
-								tmp = std::to_string(line) + ", "
-									+ std::to_string(local_offset) + ", "
-									+ std::to_string(arg_offset);
+								tmp = std::to_string(op.args[0]) + ", "
+									+ std::to_string(op.args[1]) + ", "
+									+ std::to_string(op.args[2]);
 								d.emit("",".endfunc", tmp);
 								break;
 							}
 
-							// etag? reserved for enums but not actually used?
 							case D_C_STAG:
 							case D_C_ETAG:
 							case D_C_UTAG: {
 								const char *kOpNames[] = { ".stag", ".etag", ".utag" };
-								const char *opname = kOpNames[op - D_C_STAG];
-
-								std::string name = read_cstring(iter);
-								uint16_t size = read_16(iter);
-								uint16_t tag = read_16(iter);
+								const char *opname = kOpNames[op.op - D_C_STAG];
 
 								std::string tmp;
-								tmp = name + ", " + std::to_string(size) + ", " + std::to_string(tag);
+								tmp = op.name + ", " + std::to_string(op.args[0]) + ", " + std::to_string(op.args[1]);
 								d.emit("", opname, tmp);
 								break;
 							}
@@ -445,105 +824,59 @@ bool dump_obj(const char *name, int fd)
 
 							case D_C_MEMBER:
 							case D_C_SYM: {
-								// warning - i don't fully understand this one..
-								std::string name = read_cstring(iter);
-								uint8_t version = read_8(iter); //???
-								uint32_t value;
-								if (version == 0) value = read_16(iter); // symbol
-								if (version == 1) value = read_32(iter); // numeric value.
-								assert(version == 0 || version == 1);
-								uint32_t type = read_32(iter);
-								uint8_t klass = read_8(iter);
-								uint16_t size = read_16(iter);
-
-
 								const char *opname = ".sym";
-								if (op == D_C_MEMBER) opname = ".member";
-
+								if (op.op == D_C_MEMBER) opname = ".member";
 
 								std::string attr;
 
-								if (version == 0) {
+								if (op.version == 0) {
 									std::string svalue;
-									svalue = d.symbol_name(value);
-
-									attr = name + ", " + svalue;
-								}
+									svalue = d.symbol_name(op.value);
 
-								if (version == 1) {
-									attr = name + ", " + std::to_string(value);
+									attr = op.name + ", " + svalue;
 								}
 
-								attr += ", " + std::to_string(type);
-								attr += ", " + std::to_string(klass);
-								attr += ", " + std::to_string(size);
-
-
-								/*
-								 * type bits 1 ... 5 are T_xxxx
-								 * then 3 bits of DT_xxx (repeatedly)
-								 *
-								 * eg, char ** = (DT_PTR << 11) + (DT_PTR << 8) + T_CHAR
-								 */
-								int t = type & 0x1f;
-								if ((t == T_STRUCT) || (t == T_UNION)) {
-									uint16_t tag = read_16(iter);
-									attr += ", " + std::to_string(tag);
+								if (op.version == 1) {
+									attr = op.name + ", " + std::to_string(op.value);
 								}
 
-								// need to do it until t == 0 for
-								// multidimensional arrays.
-								for ( t = type >> 5; t; t >>= 3) {
-									if ((t & 0x07) == DT_ARY) {
-										uint16_t dim = read_16(iter);
-										attr += ", " + std::to_string(dim);
-									}
-								}
+								attr += ", " + std::to_string(op.type);
+								attr += ", " + std::to_string(op.klass);
 
+								// size, then the tag and array dimensions.
+								for (auto x : op.args)
+									attr += ", " + std::to_string(x);
 
 								d.emit("", opname, attr);
 
 								break;
 							}
-
-							default:
-								errx(EX_DATAERR, "%s: unknown debug opcode %02x (%d)", name, op, op);
-								break;
-
 						}
 					}
 				}
 				break;
 
-			case REC_SECT: {
-				uint8_t sec = read_8(iter);
-				d.set_section(sec);
+			case REC_SECT:
+				d.set_section(r.value);
+				sec = r.value;
 				break;
-			}
 
-			case REC_ORG: {
+			case REC_ORG:
 				d.flush();
-				uint32_t org = read_32(iter);
-				d.emit("", ".org", d.to_x(org, 4, '$'));
-				d.set_pc(org);
+				d.emit("", ".org", d.to_x(r.value, 4, '$'));
+				d.set_pc(r.value);
+				if (sec < pc.size()) pc[sec] = r.value;
 				break;
-			}
 
-			case REC_SPACE: {
-				uint16_t count = read_16(iter);
-				d.space(count);
+			case REC_SPACE:
+				d.space(r.value);
+				advance(r.value);
 				break;
-			}
 
-			case REC_LINE: {
-				// bump line counter, no argument.
+			case REC_LINE:
 				d.flush();
 				++line;
 				break;
-			}
-			default:
-				d.flush();
-				errx(EX_DATAERR, "%s: unknown opcode %02x", name, op);
 		}
 	}
 
@@ -552,7 +885,7 @@ bool dump_obj(const char *name, int fd)
 	if (flags.S) f |= 0x01;
 	d.back_matter(f);
 
-	if (iter != data.end() || op != REC_END) errx(EX_DATAERR, "%s records ended early", name);
+	if (iter != data.cend() || r.op != REC_END) errx(EX_DATAERR, "%s records ended early", name);
 
 
 
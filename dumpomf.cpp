@@ -0,0 +1,248 @@
+#include <string>
+#include <err.h>
+#include <unistd.h>
+#include <sysexits.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "omf.h"
+#include "omf_reader.h"
+#include "disassembler.h"
+
+
+struct {
+	bool s = false;
+	bool r = false;
+} flags;
+
+
+void usage(int rv) {
+	fputs(
+		"wdcdumpomf [flags] file ...\n\n"
+		"Flags:\n"
+		" -h               show usage\n"
+		" -s               summary only (headers, no disassembly)\n"
+		" -r               list relocation records\n",
+		stdout
+	);
+	exit(rv);
+}
+
+
+std::string segment_name(unsigned segnum) {
+	return "seg" + std::to_string(segnum);
+}
+
+std::string fixup_name(unsigned segnum, uint32_t offset, uint8_t shift) {
+	std::string s = segment_name(segnum);
+	if (offset) s += "+" + disassembler::to_x(offset, 4, '$');
+	int8_t n = shift;
+	if (n < 0) s += ">>" + std::to_string(-n);
+	if (n > 0) s += "<<" + std::to_string(n);
+	return s;
+}
+
+
+void print_header(const omf::segment &seg, const omf_reader::header &h) {
+	printf("; segment %u %s", seg.segnum, seg.segname.c_str());
+	if (!seg.loadname.empty()) printf(" (%s)", seg.loadname.c_str());
+	printf("\n");
+	printf(";   offset    $%06x  bytes    $%06x  version  %u\n", h.offset, h.bytecount, h.version);
+	printf(";   kind      $%04x    banksize $%06x  org      $%06x  align $%06x\n",
+		seg.kind, h.banksize, seg.org, seg.alignment);
+	printf(";   length    $%06x  reserved $%06x  entry    $%06x\n",
+		h.length, seg.reserved_space, h.entry);
+	printf(";   records   %u  relocs %u  intersegs %u  super %u\n",
+		h.records, (unsigned)seg.relocs.size(), (unsigned)seg.intersegs.size(), h.super_records);
+
+	if (flags.r) {
+		for (const auto &r : seg.relocs) {
+			printf(";   reloc     %02x %02x %06x %06x\n",
+				r.size, r.shift, r.offset, r.value);
+		}
+		for (const auto &r : seg.intersegs) {
+			printf(";   interseg  %02x %02x %06x %02x %04x %06x\n",
+				r.size, r.shift, r.offset, r.file, r.segment, r.segment_offset);
+		}
+	}
+	printf("\n");
+}
+
+void print_express(const omf_reader &reader) {
+	printf("; ExpressLoad\n");
+	for (const auto &e : reader.express()) {
+		printf(";   segment %u %-20s lconst $%06x $%06x  reloc $%06x $%06x\n",
+			e.segnum, e.segname.c_str(), e.lconst_mark, e.lconst_size, e.reloc_mark, e.reloc_size);
+	}
+	printf("\n");
+}
+
+// the ExpressLoad table has to match the segments exactly or the loader will misbehave.
+void check_express(const std::string &path, const omf_reader &reader,
+	const std::vector< std::pair<omf::segment, omf_reader::header> > &segments) {
+
+	for (const auto &e : reader.express()) {
+
+		auto iter = std::find_if(segments.begin(), segments.end(), [&](const auto &x){
+			return x.first.segnum == e.segnum;
+		});
+		if (iter == segments.end()) {
+			warnx("%s: ExpressLoad segment %u does not exist", path.c_str(), e.segnum);
+			continue;
+		}
+		const auto &seg = iter->first;
+		const auto &h = iter->second;
+
+		if (!h.express_ok) {
+			warnx("%s: segment %u is not ExpressLoad compatible", path.c_str(), e.segnum);
+			continue;
+		}
+		if (e.lconst_mark != h.lconst_mark || e.lconst_size != h.lconst_size)
+			warnx("%s: segment %u: ExpressLoad lconst $%06x $%06x, expected $%06x $%06x", path.c_str(), e.segnum,
+				e.lconst_mark, e.lconst_size, h.lconst_mark, h.lconst_size);
+		if (e.reloc_mark != h.reloc_mark || e.reloc_size != h.reloc_size)
+			warnx("%s: segment %u: ExpressLoad reloc $%06x $%06x, expected $%06x $%06x", path.c_str(), e.segnum,
+				e.reloc_mark, e.reloc_size, h.reloc_mark, h.reloc_size);
+		if (e.kind != seg.kind || e.org != seg.org || e.alignment != seg.alignment || e.banksize != h.banksize || e.header_segnum != seg.segnum)
+			warnx("%s: segment %u: ExpressLoad header doesn't match", path.c_str(), e.segnum);
+	}
+}
+
+
+// m/x for each reachable block, following branches and calls within the segment.
+std::vector<control_flow::block> find_blocks(const std::string &path, const omf::segment &seg, const omf_reader::header &h) {
+
+	const auto &data = seg.data;
+	control_flow cf(data.data(), data.data() + data.size(), 0, disassembler::wdc);
+
+	cf.add_entry(0);
+	if (h.entry) cf.add_entry(h.entry);
+	for (const auto &r : seg.relocs) {
+		if (r.shift == 0 && r.size >= 2) cf.add_reference(r.offset, r.value);
+	}
+
+	const auto &blocks = cf.run();
+	for (const auto &b : blocks) {
+		if (b.conflict)
+			warnx("%s: segment %u: conflicting m/x states at $%04x", path.c_str(), seg.segnum, b.pc);
+	}
+	return blocks;
+}
+
+
+void disassemble(const std::string &path, const omf::segment &seg, const omf_reader::header &h) {
+
+	struct fixup {
+		uint32_t offset;
+		unsigned size;
+		uint32_t value;
+		std::string expr;
+	};
+
+	std::vector<fixup> fixups;
+	fixups.reserve(seg.relocs.size() + seg.intersegs.size());
+	for (const auto &r : seg.relocs)
+		fixups.push_back(fixup{ r.offset, r.size, r.value, fixup_name(seg.segnum, r.value, r.shift) });
+	for (const auto &r : seg.intersegs)
+		fixups.push_back(fixup{ r.offset, r.size, r.segment_offset, fixup_name(r.segment, r.segment_offset, r.shift) });
+	std::stable_sort(fixups.begin(), fixups.end(), [](const fixup &a, const fixup &b){
+		return a.offset < b.offset;
+	});
+
+	bool code = (seg.kind & 0x1f) == 0;
+	std::vector<control_flow::block> blocks;
+	if (code) blocks = find_blocks(path, seg, h);
+
+	disassembler d(disassembler::wdc | disassembler::track_rep_sep);
+
+	disassembler::emit(segment_name(seg.segnum), "section");
+	d.set_pc(0);
+	d.set_code(code);
+
+	auto iter = fixups.begin();
+	auto block = blocks.begin();
+	const auto &data = seg.data;
+	uint32_t i = 0;
+	while (i < data.size()) {
+		while (block != blocks.end() && block->pc < i) ++block;
+		if (block != blocks.end() && block->pc == i) {
+			// start each block with the inferred m/x (rep/sep are tracked within it).
+			d.flush();
+			d.set_m(block->m());
+			d.set_x(block->x());
+			++block;
+		}
+
+		while (iter != fixups.end() && iter->offset < i) ++iter; // overlapping
+		if (iter != fixups.end() && iter->offset == i && i + iter->size <= data.size()) {
+			d(iter->expr, iter->size, iter->value);
+			i += iter->size;
+			++iter;
+			continue;
+		}
+		d(data[i++]);
+	}
+	if (seg.reserved_space) d.space(seg.reserved_space);
+	d.flush();
+
+	disassembler::emit("", "ends");
+	printf("\n");
+}
+
+
+void dump(const std::string &path) {
+
+	omf_reader reader;
+	if (!reader.open(path)) err(EX_NOINPUT, "Unable to open %s", path.c_str());
+
+	printf("; %s\n\n", path.c_str());
+
+	std::vector< std::pair<omf::segment, omf_reader::header> > segments;
+
+	omf::segment seg;
+	omf_reader::header h;
+	while (reader.next(seg, h)) {
+		print_header(seg, h);
+		if (omf_reader::is_express(seg)) {
+			print_express(reader);
+		} else if (!flags.s) {
+			disassemble(path, seg, h);
+		}
+
+		// keep the headers for the ExpressLoad check.
+		seg.data.clear();
+		seg.relocs.clear();
+		seg.intersegs.clear();
+		segments.emplace_back(std::move(seg), h);
+	}
+
+	check_express(path, reader, segments);
+}
+
+
+int main(int argc, char **argv) {
+
+	int c;
+	while ((c = getopt(argc, argv, "hsr")) != -1) {
+		switch(c) {
+			case 'h': usage(0); break;
+			case 's': flags.s = true; break;
+			case 'r': flags.r = true; break;
+			default: usage(EX_USAGE); break;
+		}
+	}
+
+	argv += optind;
+	argc -= optind;
+
+	if (argc == 0) usage(EX_USAGE);
+
+	for (int i = 0; i < argc; ++i) {
+		dump(argv[i]);
+	}
+
+	return 0;
+}
@@ -1,10 +1,34 @@
 #include "expression.h"
 #include <vector>
+#include <utility>
 #include "obj816.h"
 
 #include <sysexits.h>
 #include <err.h>
 
+/*
+ * a stack in pre-allocated storage.  simplify_expression uses the
+ * expression's own nodes; the stack never grows past the node being read.
+ */
+class expr_stack {
+public:
+	expr_stack(expr *base) : _base(base) {}
+
+	size_t size() const { return _size; }
+	expr &back() { return _base[_size - 1]; }
+	expr &front() { return _base[0]; }
+	expr &operator[](size_t i) { return _base[i]; }
+
+	void pop_back() { --_size; }
+
+	template<class... Args>
+	void emplace_back(Args&&... args) { _base[_size++] = expr(std::forward<Args>(args)...); }
+
+private:
+	expr *_base;
+	size_t _size = 0;
+};
+
 /* a ** b */
 uint32_t power(uint32_t a, uint32_t b) {
 
@@ -16,16 +40,16 @@ uint32_t power(uint32_t a, uint32_t b) {
 	return rv; 
 }
 
-bool unary_op(unsigned op, std::vector<expr> &v) {
+bool unary_op(unsigned op, expr_stack &v) {
 	if (v.size() >=1 ) {
 		expr &a = v.back();
 		if (a.tag == OP_VAL) {
-			switch(a.tag) {
+			switch(op) {
 			case OP_NOT: a.value = !a.value; break;
 			case OP_NEG: a.value = -a.value; break;
 			case OP_FLP: a.value = ~a.value; break;
 			default:
-				errx(EX_SOFTWARE, "Unsupported unary op %02x", a.tag);
+				errx(EX_SOFTWARE, "Unsupported unary op %02x", op);
 			}
 			return true;
 		}
@@ -35,12 +59,13 @@ bool unary_op(unsigned op, std::vector<expr> &v) {
 }
 
 
-bool binary_op(unsigned op, std::vector<expr> &v) {
+bool binary_op(unsigned op, expr_stack &v) {
 	if (v.size() >= 2) {
 		expr &a = v[v.size() - 2];
 		expr &b = v[v.size() - 1];
 
-		if (a.tag == OP_VAL && b.tag == OP_VAL) {
+		// leave division by 0 for the error message.
+		if (a.tag == OP_VAL && b.tag == OP_VAL && (b.value || (op != OP_DIV && op != OP_MOD))) {
 			uint32_t value = 0;
 			switch(op) {
 			case OP_EXP: value = power(a.value, b.value); break;
@@ -60,7 +85,7 @@ bool binary_op(unsigned op, std::vector<expr> &v) {
 			case OP_UGT: value = a.value > b.value; break;
 			case OP_ULT: value = a.value < b.value; break;
 			default:
-				errx(EX_SOFTWARE, "Unsupported binary op %02x", a.tag);
+				errx(EX_SOFTWARE, "Unsupported binary op %02x", op);
 			}
 			v.pop_back();
 			v.back().value = value;
@@ -141,10 +166,30 @@ bool binary_op(unsigned op, std::vector<expr> &v) {
 }
 
 
-bool simplify_expression(expression &e) {
-	std::vector<expr> tmp;
+static uint8_t classify(const expr_range<expr> &nodes, bool relative) {
+
+	if (nodes.size() == 1) {
+		unsigned tag = nodes[0].tag;
+		if (tag != OP_VAL && tag != OP_LOC) return FIXUP_COMPLEX;
+		if (relative) return FIXUP_RELATIVE;
+		return tag == OP_VAL ? FIXUP_VALUE : FIXUP_LOC;
+	}
+
+	if (nodes.size() == 3) {
+		const auto &loc = nodes[0];
+		const auto &shift = nodes[1];
+		const auto &op = nodes[2];
+		if (loc.tag == OP_LOC && shift.tag == OP_VAL && (op.tag == OP_SHL || op.tag == OP_SHR))
+			return FIXUP_SHIFT;
+	}
+	return FIXUP_COMPLEX;
+}
+
+bool simplify_expression(expr_pool &pool, expression &e) {
+	auto nodes = pool[e];
+	expr_stack tmp(nodes.begin());
 	bool rv = false;
-	for (auto &t : e.stack) {
+	for (auto t : nodes) {
 		if (t.tag >= OP_BIN) {
 			rv = binary_op(t.tag, tmp) || rv;
 		} else if (t.tag >= OP_UNA) {
@@ -153,7 +198,8 @@ bool simplify_expression(expression &e) {
 			tmp.emplace_back(t);
 		}
 	}
-	if (rv) e.stack = std::move(tmp);
+	if (rv) e.length = tmp.size();
+	e.kind = classify(pool[e], e.relative);
 	return rv;
 }
 
@@ -161,9 +207,18 @@ bool simplify_expression(expression &e) {
  * if force is true, treat OP_LOC records as OP_VAL (for omf)
  */
 
-optional<uint32_t> evaluate_expression(expression &e, bool force) {
-	std::vector<expr> tmp;
-	for (const auto &t : e.stack) {
+optional<uint32_t> evaluate_expression(const expr_pool &pool, const expression &e, bool force) {
+
+	expr buffer[16];
+	std::vector<expr> large;
+	expr *base = buffer;
+	if (e.length > 16) {
+		large.resize(e.length);
+		base = large.data();
+	}
+
+	expr_stack tmp(base);
+	for (const auto &t : pool[e]) {
 		if (t.tag == OP_LOC && force) {
 			tmp.emplace_back(OP_VAL, t.value);
 			continue;				
@@ -180,4 +235,3 @@ optional<uint32_t> evaluate_expression(expression &e, bool force) {
 	if (tmp.size() == 1 && tmp.front().tag == OP_VAL) return optional<uint32_t>(tmp.front().value);
 	return optional<uint32_t>();
 }
-
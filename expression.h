@@ -2,33 +2,119 @@
 #define __expression_h__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <vector>
 
 #include "optional.h"
 
+/*
+ * 8 bytes. section is the section (or symbol) number and is limited to 24 bits.
+ */
 struct expr {
 	expr(int t = 0, uint32_t v = 0, uint32_t s = 0)
-		: tag(t), value(v), section(s)
+		: tag(t), section(s), value(v)
 	{}
-	int tag = 0;
-	uint32_t value = 0;
-	unsigned section = 0;
+	uint32_t tag : 8;
+	uint32_t section : 24;
+	uint32_t value;
 };
 
 
+/*
+ * what a simplified expression will turn into (see to_omf).
+ * set by simplify_expression.
+ */
+enum {
+	FIXUP_COMPLEX = 0,	/* anything else. may simplify further once symbols/segments are known */
+	FIXUP_VALUE,		/* constant */
+	FIXUP_LOC,			/* location + addend (reloc or interseg) */
+	FIXUP_SHIFT,		/* location + addend, shifted by a constant */
+	FIXUP_RELATIVE,		/* relative branch to a constant or location */
+};
+
+
+/*
+ * the expression nodes live in an expr_pool; start/length is the
+ * slice belonging to this expression.
+ */
 struct expression {
 	unsigned section = 0;
 	uint32_t offset = 0;
 	uint8_t size = 0;
 	uint8_t relative = false;
 	bool undefined = false;
+	uint8_t kind = FIXUP_COMPLEX;
+
+	uint32_t start = 0;
+	uint32_t length = 0;
+};
+
 
-	std::vector<expr> stack;
+template<class T>
+struct expr_range {
+	T *first;
+	T *last;
 
+	T *begin() const { return first; }
+	T *end() const { return last; }
+	size_t size() const { return last - first; }
+	bool empty() const { return first == last; }
+	T &operator[](size_t i) const { return first[i]; }
 };
 
-optional<uint32_t> evaluate_expression(expression &e, bool force = false);
 
-bool simplify_expression(expression &e);
+/*
+ * contiguous storage for expression nodes.
+ */
+class expr_pool {
+public:
+
+	expr_range<expr> operator[](const expression &e) {
+		expr *cp = _nodes.data() + e.start;
+		return expr_range<expr>{ cp, cp + e.length };
+	}
+
+	expr_range<const expr> operator[](const expression &e) const {
+		const expr *cp = _nodes.data() + e.start;
+		return expr_range<const expr>{ cp, cp + e.length };
+	}
+
+	// nodes may only be pushed onto the most recently started expression.
+	void start(expression &e) {
+		e.start = _nodes.size();
+		e.length = 0;
+	}
+
+	void push(expression &e, const expr &x) {
+		_nodes.push_back(x);
+		e.length++;
+	}
+
+	// copy nodes (from another pool) as a new expression.
+	void assign(expression &e, const expr *first, const expr *last) {
+		e.start = _nodes.size();
+		e.length = last - first;
+		_nodes.insert(_nodes.end(), first, last);
+	}
+
+	// drop anything past the end of the most recent expression (after simplifying it).
+	void shrink(const expression &e) {
+		_nodes.resize(e.start + e.length);
+	}
+
+	size_t size() const { return _nodes.size(); }
+	void reserve(size_t n) { _nodes.reserve(n); }
+	void clear() { _nodes.clear(); }
+
+private:
+	std::vector<expr> _nodes;
+};
+
+
+// in place, without allocating (evaluate only allocates for very long expressions).
+optional<uint32_t> evaluate_expression(const expr_pool &pool, const expression &e, bool force = false);
+
+// folds constants and classifies the result.
+bool simplify_expression(expr_pool &pool, expression &e);
 
 #endif
@@ -0,0 +1,489 @@
+/*
+ * generate a synthetic set of object files and libraries (for benchmarking).
+ *
+ * output directory contains obj0.obj ... objN.obj and lib0.lib ... libN.lib.
+ * every object references symbols from the other objects and from the
+ * libraries; library modules only reference the same or later libraries
+ * so the result also links with wdclink -s.
+ *
+ * output is deterministic for a given seed.
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <err.h>
+#include <unistd.h>
+#include <sysexits.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "obj816.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#endif
+
+
+struct {
+	std::string o = ".";
+	unsigned objects = 100;		// -m
+	unsigned size = 4096;		// -b approximate record bytes per module
+	unsigned sections = 2;		// -n named sections
+	unsigned globals = 8;		// -g global symbols per module
+	unsigned locals = 8;		// -s local labels per module
+	unsigned externs = 8;		// -x external references per module
+	unsigned expressions = 30;	// -e percent of records that are expressions
+	unsigned space = 3;			// -z percent of records that are REC_SPACE
+	unsigned debug = 5;			// -d percent of records that are debug records
+	unsigned libraries = 2;		// -l
+	unsigned lib_modules = 200;	// -L modules per library
+	uint32_t seed = 1;			// -r
+} flags;
+
+
+// xorshift32. std:: distributions aren't reproducible across libraries.
+class rng {
+public:
+	rng(uint32_t seed) : _state(seed ? seed : 0x2545f491) {}
+
+	uint32_t next() {
+		uint32_t x = _state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return _state = x;
+	}
+
+	// [0, n)
+	uint32_t operator()(uint32_t n) { return n ? next() % n : 0; }
+
+	bool percent(unsigned n) { return next() % 100 < n; }
+
+private:
+	uint32_t _state;
+};
+
+
+void push(std::vector<uint8_t> &v, uint8_t x) {
+	v.push_back(x);
+}
+
+void push(std::vector<uint8_t> &v, uint16_t x) {
+	v.push_back(x & 0xff);
+	v.push_back(x >> 8);
+}
+
+void push(std::vector<uint8_t> &v, uint32_t x) {
+	v.push_back(x & 0xff);
+	v.push_back(x >> 8);
+	v.push_back(x >> 16);
+	v.push_back(x >> 24);
+}
+
+void push(std::vector<uint8_t> &v, const std::string &s) {
+	v.insert(v.end(), s.begin(), s.end());
+	v.push_back(0);
+}
+
+
+std::string object_global(unsigned module, unsigned n) {
+	return "m" + std::to_string(module) + "_g" + std::to_string(n);
+}
+
+std::string library_global(unsigned lib, unsigned module, unsigned n) {
+	return "l" + std::to_string(lib) + "_m" + std::to_string(module) + "_g" + std::to_string(n);
+}
+
+std::string section_name(unsigned n) {
+	return "SEC" + std::to_string(n);
+}
+
+// named section flags must be consistent between modules.
+uint8_t section_flags(unsigned n) {
+	return n & 1 ? SEC_DATA : 0;
+}
+
+
+struct symbol {
+	std::string name;
+	uint8_t type = S_UND;
+	uint8_t flags = 0;
+	uint8_t section = 0;
+	uint32_t offset = 0;
+};
+
+/*
+ * a module with the given globals and externs.
+ */
+std::vector<uint8_t> module(rng &r, const std::string &name,
+	const std::vector<std::string> &globals,
+	const std::vector<std::string> &externs) {
+
+	unsigned nsections = 5 + flags.sections;
+	std::vector<uint32_t> sizes(nsections, 0);
+	std::vector<symbol> symbols;
+
+	for (const auto &e : externs) {
+		symbol s;
+		s.name = e;
+		symbols.emplace_back(std::move(s));
+	}
+
+	// labels are defined as we go so branches have somewhere to go.
+	std::vector<unsigned> labels[256];
+	unsigned next_global = 0;
+	unsigned next_local = 0;
+
+	// page0 and udata are reference only.
+	std::vector<unsigned> data_sections = { SECT_CODE, SECT_KDATA, SECT_DATA };
+	for (unsigned i = 5; i < nsections; ++i) data_sections.push_back(i);
+
+	std::vector<uint8_t> records;
+	unsigned section = SECT_CODE;
+	push(records, (uint8_t)REC_SECT);
+	push(records, (uint8_t)section);
+
+	auto define = [&](std::string name, bool global) {
+		symbol s;
+		s.name = std::move(name);
+		s.type = S_REL;
+		s.flags = global ? SF_DEF | SF_GBL : SF_DEF;
+		s.section = section;
+		s.offset = sizes[section];
+		labels[section].push_back(symbols.size());
+		symbols.emplace_back(std::move(s));
+	};
+
+	unsigned label_every = std::max(1u, flags.size / 16 / std::max(1u, (unsigned)globals.size() + flags.locals));
+
+	for (unsigned count = 0; records.size() < flags.size; ++count) {
+
+		if (r.percent(3)) {
+			section = data_sections[r(data_sections.size())];
+			push(records, (uint8_t)REC_SECT);
+			push(records, (uint8_t)section);
+		}
+
+		if (count % label_every == 0) {
+			if (next_global < globals.size()) define(globals[next_global++], true);
+			else if (next_local < flags.locals) define(name + "_l" + std::to_string(next_local++), false);
+		}
+
+		unsigned x = r(100);
+
+		if (x < flags.expressions) {
+			auto &here = labels[section];
+
+			// relative branch back to a local label.
+			if (section == SECT_CODE && !here.empty() && r.percent(25)) {
+				const auto &target = symbols[here[r(here.size())]];
+				if (sizes[section] - target.offset < 0x7000) {
+					push(records, (uint8_t)REC_RELEXP);
+					push(records, (uint8_t)2);
+					push(records, (uint8_t)OP_SYM);
+					push(records, (uint16_t)(&target - symbols.data()));
+					push(records, (uint8_t)OP_END);
+					sizes[section] += 2;
+					continue;
+				}
+			}
+
+			uint8_t size = "\x02\x02\x02\x03\x03\x04\x01\x02"[r(8)];
+			push(records, (uint8_t)REC_EXPR);
+			push(records, size);
+
+			if (!symbols.empty() && r.percent(60)) {
+				push(records, (uint8_t)OP_SYM);
+				push(records, (uint16_t)r(symbols.size()));
+			} else {
+				unsigned s = data_sections[r(data_sections.size())];
+				push(records, (uint8_t)OP_LOC);
+				push(records, (uint8_t)s);
+				push(records, (uint32_t)r(sizes[s] + 1));
+			}
+
+			if (size == 1) {
+				// bank byte.
+				push(records, (uint8_t)OP_VAL);
+				push(records, (uint32_t)16);
+				push(records, (uint8_t)OP_SHR);
+			} else if (r.percent(20)) {
+				push(records, (uint8_t)OP_VAL);
+				push(records, (uint32_t)r(16));
+				push(records, (uint8_t)OP_ADD);
+			}
+			push(records, (uint8_t)OP_END);
+			sizes[section] += size;
+			continue;
+		}
+		x -= flags.expressions;
+
+		if (x < flags.space) {
+			uint16_t n = 1 + r(2048);
+			push(records, (uint8_t)REC_SPACE);
+			push(records, n);
+			sizes[section] += n;
+			continue;
+		}
+		x -= flags.space;
+
+		if (x < flags.debug) {
+			// D_C_LINE
+			push(records, (uint8_t)REC_DEBUG);
+			push(records, (uint16_t)3);
+			push(records, (uint8_t)D_C_LINE);
+			push(records, (uint16_t)r(10000));
+			continue;
+		}
+		x -= flags.debug;
+
+		if (x < 5) {
+			push(records, (uint8_t)REC_LINE);
+			continue;
+		}
+
+		unsigned n = 1 + r(48);
+		push(records, (uint8_t)n);
+		for (unsigned i = 0; i < n; ++i) push(records, (uint8_t)r(256));
+		sizes[section] += n;
+	}
+
+	while (next_global < globals.size()) define(globals[next_global++], true);
+
+	push(records, (uint8_t)REC_END);
+
+	sizes[SECT_UDATA] = r(512);
+
+	symbol equ;
+	equ.name = name + "_equ";
+	equ.type = S_ABS | (ST_EQU << 4);
+	equ.flags = SF_DEF;
+	equ.section = SECT_CODE;
+	equ.offset = r(0x10000);
+	symbols.emplace_back(std::move(equ));
+
+
+	std::vector<uint8_t> secdata;
+	for (unsigned i = 0; i < nsections; ++i) {
+		uint8_t f = i < 5 ? SEC_NONAME : section_flags(i - 5);
+		if (i == SECT_PAGE0) f |= SEC_DATA | SEC_DIRECT | SEC_REF_ONLY;
+		if (i == SECT_KDATA || i == SECT_DATA) f |= SEC_DATA;
+		if (i == SECT_UDATA) f |= SEC_DATA | SEC_REF_ONLY;
+		push(secdata, (uint8_t)i);
+		push(secdata, f);
+		push(secdata, sizes[i]);
+		push(secdata, (uint32_t)0);
+		if (i >= 5) push(secdata, section_name(i - 5));
+	}
+
+	std::vector<uint8_t> symdata;
+	for (const auto &s : symbols) {
+		push(symdata, s.type);
+		push(symdata, s.flags);
+		push(symdata, s.section);
+		if (s.type != S_UND) push(symdata, s.offset);
+		push(symdata, s.name);
+	}
+
+	std::vector<uint8_t> rv;
+	push(rv, (uint32_t)MOD_MAGIC);
+	push(rv, (uint16_t)MOD_VERSION);
+	push(rv, (uint8_t)MOD_OBJECT);
+	push(rv, (uint8_t)(name.size() + 1));
+	push(rv, (uint32_t)records.size());
+	push(rv, (uint16_t)secdata.size());
+	push(rv, (uint32_t)symdata.size());
+	push(rv, (uint16_t)0);
+	push(rv, (uint8_t)nsections);
+	push(rv, (uint8_t)nsections);
+	push(rv, (uint16_t)symbols.size());
+
+	push(rv, name);
+	rv.insert(rv.end(), records.begin(), records.end());
+	rv.insert(rv.end(), secdata.begin(), secdata.end());
+	rv.insert(rv.end(), symdata.begin(), symdata.end());
+	return rv;
+}
+
+
+std::vector<uint8_t> library(const std::vector< std::vector<uint8_t> > &modules,
+	const std::vector< std::vector<std::string> > &globals) {
+
+	std::vector<uint8_t> files;
+	push(files, (uint16_t)1);
+	push(files, (uint8_t)5);
+	files.insert(files.end(), {'g', 'e', 'n', '.', 'c'});
+
+	std::vector<uint8_t> entries;
+	std::vector<uint8_t> names;
+	uint32_t offset = 0;
+	unsigned count = 0;
+	for (size_t i = 0; i < modules.size(); ++i) {
+		for (const auto &g : globals[i]) {
+			push(entries, (uint16_t)names.size());
+			push(entries, (uint16_t)1);
+			push(entries, offset);
+			push(names, (uint8_t)g.size());
+			names.insert(names.end(), g.begin(), g.end());
+			++count;
+		}
+		offset += modules[i].size();
+	}
+	if (names.size() > 0xffff)
+		errx(EX_USAGE, "library dictionary too large (fewer modules or globals)");
+
+	std::vector<uint8_t> rv;
+	push(rv, (uint32_t)MOD_MAGIC);
+	push(rv, (uint16_t)MOD_VERSION);
+	push(rv, (uint8_t)MOD_LIBRARY);
+	push(rv, (uint8_t)0);
+	push(rv, (uint32_t)(sizeof(Lib_head) + files.size() + entries.size() + names.size()));
+	push(rv, (uint32_t)count);
+	push(rv, (uint32_t)(entries.size() + names.size()));
+	push(rv, (uint32_t)1);
+
+	rv.insert(rv.end(), files.begin(), files.end());
+	rv.insert(rv.end(), entries.begin(), entries.end());
+	rv.insert(rv.end(), names.begin(), names.end());
+	for (const auto &m : modules) rv.insert(rv.end(), m.begin(), m.end());
+	return rv;
+}
+
+
+void save(const std::string &name, const std::vector<uint8_t> &data) {
+	std::string path = flags.o + "/" + name;
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	if (fd < 0) err(EX_CANTCREAT, "Unable to open %s", path.c_str());
+	if (write(fd, data.data(), data.size()) != (ssize_t)data.size())
+		err(EX_IOERR, "write %s", path.c_str());
+	close(fd);
+}
+
+
+void usage(int rv) {
+	fputs(
+		"wdcgenobj [flags]\n\n"
+		"Flags:\n"
+		" -h               show usage\n"
+		" -o dir           output directory (default .)\n"
+		" -m n             number of object files (100)\n"
+		" -b n             approximate record bytes per module (4096)\n"
+		" -n n             named sections (2)\n"
+		" -g n             global symbols per module (8)\n"
+		" -s n             local labels per module (8)\n"
+		" -x n             external references per module (8)\n"
+		" -e n             percent of records that are expressions (30)\n"
+		" -z n             percent of records that are REC_SPACE (3)\n"
+		" -d n             percent of records that are debug records (5)\n"
+		" -l n             number of libraries (2)\n"
+		" -L n             modules per library (200)\n"
+		" -r n             random seed (1)\n",
+		stdout
+	);
+	exit(rv);
+}
+
+unsigned number(const char *cp) {
+	char *end;
+	unsigned long n = strtoul(cp, &end, 10);
+	if (*end || end == cp) errx(EX_USAGE, "Invalid number: %s", cp);
+	return n;
+}
+
+int main(int argc, char **argv) {
+
+	int c;
+	while ((c = getopt(argc, argv, "ho:m:b:n:g:s:x:e:z:d:l:L:r:")) != -1) {
+		switch(c) {
+			case 'h': usage(0); break;
+			case 'o': flags.o = optarg; break;
+			case 'm': flags.objects = number(optarg); break;
+			case 'b': flags.size = number(optarg); break;
+			case 'n': flags.sections = number(optarg); break;
+			case 'g': flags.globals = number(optarg); break;
+			case 's': flags.locals = number(optarg); break;
+			case 'x': flags.externs = number(optarg); break;
+			case 'e': flags.expressions = number(optarg); break;
+			case 'z': flags.space = number(optarg); break;
+			case 'd': flags.debug = number(optarg); break;
+			case 'l': flags.libraries = number(optarg); break;
+			case 'L': flags.lib_modules = number(optarg); break;
+			case 'r': flags.seed = number(optarg); break;
+			default: usage(EX_USAGE); break;
+		}
+	}
+
+	if (flags.expressions + flags.space + flags.debug > 90)
+		errx(EX_USAGE, "-e + -z + -d must be <= 90");
+	if (flags.sections > 200)
+		errx(EX_USAGE, "-n must be <= 200");
+	if (flags.objects == 0)
+		errx(EX_USAGE, "-m must be > 0");
+
+	if (mkdir(flags.o.c_str(), 0777) < 0 && errno != EEXIST)
+		err(EX_CANTCREAT, "Unable to create %s", flags.o.c_str());
+
+	rng r(flags.seed);
+
+	for (unsigned i = 0; i < flags.objects; ++i) {
+
+		std::vector<std::string> globals;
+		for (unsigned j = 0; j < flags.globals; ++j) globals.push_back(object_global(i, j));
+
+		std::vector<std::string> externs;
+		for (unsigned j = 0; j < flags.externs; ++j) {
+			unsigned libs = flags.libraries && flags.lib_modules ? flags.libraries : 0;
+			if (libs && r.percent(50)) {
+				externs.push_back(library_global(r(libs), r(flags.lib_modules), r(flags.globals)));
+				continue;
+			}
+			unsigned m = r(flags.objects);
+			if (m == i || !flags.globals) continue;
+			externs.push_back(object_global(m, r(flags.globals)));
+		}
+		std::sort(externs.begin(), externs.end());
+		externs.erase(std::unique(externs.begin(), externs.end()), externs.end());
+
+		std::string name = "obj" + std::to_string(i);
+		save(name + ".obj", module(r, name, globals, externs));
+	}
+
+	for (unsigned l = 0; l < flags.libraries; ++l) {
+		std::vector< std::vector<uint8_t> > modules;
+		std::vector< std::vector<std::string> > lib_globals;
+
+		for (unsigned i = 0; i < flags.lib_modules; ++i) {
+			std::vector<std::string> globals;
+			for (unsigned j = 0; j < flags.globals; ++j) globals.push_back(library_global(l, i, j));
+
+			// a few references to this or later libraries.
+			std::vector<std::string> externs;
+			for (unsigned j = 0; j < flags.externs / 4; ++j) {
+				unsigned ll = l + r(flags.libraries - l);
+				unsigned m = r(flags.lib_modules);
+				if (ll == l && m == i) continue;
+				externs.push_back(library_global(ll, m, r(flags.globals)));
+			}
+			std::sort(externs.begin(), externs.end());
+			externs.erase(std::unique(externs.begin(), externs.end()), externs.end());
+
+			std::string name = "lib" + std::to_string(l) + "_m" + std::to_string(i);
+			modules.emplace_back(module(r, name, globals, externs));
+			lib_globals.emplace_back(std::move(globals));
+		}
+		save("lib" + std::to_string(l) + ".lib", library(modules, lib_globals));
+	}
+
+	return 0;
+}
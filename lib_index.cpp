@@ -0,0 +1,204 @@
+#include "lib_index.h"
+#include "replace_file.h"
+#include "string_pool.h"
+#include "obj816.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+namespace {
+
+	enum {
+		kMagic = 0x5844494c, // 'LIDX'
+		kVersion = 2,
+		kHeaderSize = 48,
+		kBucketSize = 12,
+	};
+
+	/*
+	 * header:
+	 *	l: magic
+	 *	w: version
+	 *	w: unused
+	 *	q: library size
+	 *	q: library mtime
+	 *	q: library header hash
+	 *	l: bucket count (power of 2)
+	 *	l: symbol count
+	 *	l: names size
+	 *	l: unused
+	 */
+
+	uint32_t get_32(const uint8_t *cp) {
+		return cp[0] | (cp[1] << 8) | (cp[2] << 16) | ((uint32_t)cp[3] << 24);
+	}
+
+	uint64_t get_64(const uint8_t *cp) {
+		return get_32(cp) | ((uint64_t)get_32(cp + 4) << 32);
+	}
+
+	void put_32(uint8_t *cp, uint32_t x) {
+		cp[0] = x; cp[1] = x >> 8; cp[2] = x >> 16; cp[3] = x >> 24;
+	}
+
+	void put_64(uint8_t *cp, uint64_t x) {
+		put_32(cp, x);
+		put_32(cp + 4, x >> 32);
+	}
+
+	uint64_t content_hash(const uint8_t *cp, size_t size) {
+		uint64_t h = 0xcbf29ce484222325;
+		while (size--) {
+			h ^= *cp++;
+			h *= 0x100000001b3;
+		}
+		return h;
+	}
+
+	bool library_stat(const std::string &path, uint64_t &size, uint64_t &mtime) {
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0) return false;
+		size = st.st_size;
+		mtime = st.st_mtime;
+		return true;
+	}
+}
+
+
+bool lib_index::open(const std::string &library, const mapped_file &lib, uint32_t modstart) {
+
+	uint64_t size, mtime;
+	if (modstart > lib.size()) return false;
+	if (!library_stat(library, size, mtime)) return false;
+	if (size != lib.size()) return false;
+
+	if (!_file.open(index_path(library))) return false;
+
+	const uint8_t *cp = _file.data();
+	if (_file.size() < kHeaderSize) return false;
+	if (get_32(cp + 0) != kMagic) return false;
+	if ((get_32(cp + 4) & 0xffff) != kVersion) return false;
+	if (get_64(cp + 8) != size) return false;
+	if (get_64(cp + 16) != mtime) return false;
+
+	uint32_t buckets = get_32(cp + 32);
+	uint32_t count = get_32(cp + 36);
+	uint32_t names_size = get_32(cp + 40);
+
+	if (!buckets || (buckets & (buckets - 1)) || count >= buckets) return false;
+	if (_file.size() != kHeaderSize + (uint64_t)buckets * kBucketSize + names_size) return false;
+
+	// size and mtime catch a rebuilt library; the header hash catches the
+	// rest without reading the dictionary.
+	if (modstart < sizeof(Lib_head)) return false;
+	if (get_64(cp + 24) != content_hash(lib.data(), sizeof(Lib_head))) return false;
+
+	_buckets = cp + kHeaderSize;
+	_names = _buckets + (size_t)buckets * kBucketSize;
+	_names_size = names_size;
+	_mask = buckets - 1;
+	_count = count;
+	return true;
+}
+
+optional<uint32_t> lib_index::find(const std::string &name) const {
+	return find(name.data(), name.size(), string_pool::hash(name.data(), name.size()));
+}
+
+optional<uint32_t> lib_index::find(const char *name, size_t size, uint32_t h) const {
+
+	if (!_buckets) return optional<uint32_t>();
+
+	// bounded, in case a damaged index has no empty bucket.
+	uint32_t i = h & _mask;
+	for (uint32_t n = 0; n <= _mask; ++n, i = (i + 1) & _mask) {
+		const uint8_t *b = _buckets + (size_t)i * kBucketSize;
+		uint32_t name_offset = get_32(b + 4);
+		if (!name_offset) break;
+		if (get_32(b) != h) continue;
+
+		name_offset--;
+		if (name_offset >= _names_size) break;
+		unsigned length = _names[name_offset];
+		if (name_offset + 1 + length > _names_size) break;
+		if (length == size && !memcmp(_names + name_offset + 1, name, length))
+			return optional<uint32_t>(get_32(b + 8));
+	}
+	return optional<uint32_t>();
+}
+
+
+bool lib_index::create(const std::string &library, const mapped_file &lib, uint32_t modstart,
+	const std::vector< std::pair<std::string, uint32_t> > &entries) {
+
+	uint64_t size, mtime;
+	if (modstart > lib.size()) return false;
+	if (!library_stat(library, size, mtime)) return false;
+
+	uint32_t buckets = 16;
+	while (buckets < entries.size() * 2) buckets <<= 1;
+	uint32_t mask = buckets - 1;
+
+	std::vector<uint8_t> table(kHeaderSize + (size_t)buckets * kBucketSize, 0);
+	std::vector<uint8_t> names;
+
+	for (const auto &e : entries) {
+		const std::string &name = e.first;
+		uint32_t h = string_pool::hash(name.data(), name.size());
+		uint32_t i = h & mask;
+		for(;;) {
+			uint8_t *b = table.data() + kHeaderSize + (size_t)i * kBucketSize;
+			if (!get_32(b + 4)) {
+				put_32(b, h);
+				put_32(b + 4, names.size() + 1);
+				put_32(b + 8, e.second);
+				break;
+			}
+			i = (i + 1) & mask;
+		}
+		unsigned length = std::min(name.size(), (size_t)255);
+		names.push_back(length);
+		names.insert(names.end(), name.begin(), name.begin() + length);
+	}
+
+	uint8_t *cp = table.data();
+	put_32(cp + 0, kMagic);
+	put_32(cp + 4, kVersion);
+	put_64(cp + 8, size);
+	put_64(cp + 16, mtime);
+	put_64(cp + 24, content_hash(lib.data(), sizeof(Lib_head)));
+	put_32(cp + 32, buckets);
+	put_32(cp + 36, entries.size());
+	put_32(cp + 40, names.size());
+
+	table.insert(table.end(), names.begin(), names.end());
+
+	// write to a temporary file then rename so a concurrent link never sees a partial index.
+	std::string path = index_path(library);
+
+	replace_file f;
+	if (!f.open(path)) {
+		warn("Unable to create temporary file for %s", path.c_str());
+		return false;
+	}
+
+	ssize_t ok = write(f.fd(), table.data(), table.size());
+	if (ok != (ssize_t)table.size()) {
+		warn("write %s", f.tmp().c_str());
+		return false;
+	}
+
+	if (!f.commit()) {
+		warn("Unable to replace %s", path.c_str());
+		return false;
+	}
+	return true;
+}
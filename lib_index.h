@@ -0,0 +1,61 @@
+#ifndef __lib_index_h__
+#define __lib_index_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "mapped_file.h"
+#include "optional.h"
+
+/*
+ * sidecar symbol index for a library (foo.lib -> foo.lib.idx).
+ *
+ * The index is an open-addressing hash table of symbol name -> module
+ * offset (relative to the start of the library file), so a link only has
+ * to look up the symbols it's missing instead of decoding the entire
+ * dictionary. It's only used if the library's size, mtime and header
+ * match what was recorded when it was created.
+ *
+ * format (little endian):
+ *	header
+ *	buckets (12 bytes each: name hash, string offset + 1 (0 = empty), module offset)
+ *	names (pstrings)
+ */
+class lib_index {
+
+public:
+
+	lib_index() = default;
+	lib_index(const lib_index &) = delete;
+	lib_index &operator=(const lib_index &) = delete;
+
+	static std::string index_path(const std::string &library) { return library + ".idx"; }
+
+	// library is the mapped library, modstart is the end of the dictionary.
+	bool open(const std::string &library, const mapped_file &lib, uint32_t modstart);
+
+	optional<uint32_t> find(const std::string &name) const;
+
+	// hash is string_pool::hash of the name.
+	optional<uint32_t> find(const char *name, size_t size, uint32_t hash) const;
+
+	size_t size() const { return _count; }
+
+	// entries in dictionary order. duplicate names should already be removed.
+	static bool create(const std::string &library, const mapped_file &lib, uint32_t modstart,
+		const std::vector< std::pair<std::string, uint32_t> > &entries);
+
+private:
+
+	mapped_file _file;
+	const uint8_t *_buckets = nullptr;
+	const uint8_t *_names = nullptr;
+	uint32_t _names_size = 0;
+	uint32_t _mask = 0;
+	uint32_t _count = 0;
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include <sysexits.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <fcntl.h>
 #include <err.h>
 #include <assert.h>
@@ -27,10 +28,17 @@
 #include <utility>
 #include <numeric>
 #include <iterator>
+#include <thread>
+#include <memory>
 
 #include "obj816.h"
 #include "expression.h"
 #include "omf.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "lib_index.h"
+#include "string_pool.h"
+#include "stats.h"
 
 #include "endian.h"
 
@@ -52,6 +60,15 @@ struct {
 	uint32_t aux_type = 0;
 
 	unsigned omf_flags = 0;
+	unsigned j = 1;
+	bool i = false;
+	bool s = false;
+	bool P = false;
+	bool H = false;
+	unsigned bin_format = BIN_FLAT;
+	std::vector< std::pair<std::string, uint32_t> > A; // section, address
+	bool stats = false;
+	bool stats_json = false;
 } flags;
 
 
@@ -90,7 +107,7 @@ struct Header {
 
 
 struct section {
-	std::string name;
+	uint32_t name = 0; // string_pool id
 	uint8_t flags = 0;
 	uint32_t org = 0;
 	uint32_t size = 0;
@@ -103,7 +120,7 @@ struct section {
 };
 
 struct symbol {
-	std::string name;
+	uint32_t name = 0; // string_pool id
 	uint8_t type = 0;
 	uint8_t flags = 0;
 	uint32_t offset = 0;
@@ -158,6 +175,14 @@ std::string read_cstring(T &iter) {
 }
 
 
+template<class T>
+const char *skip_cstring(T &iter) {
+	const char *cp = (const char *)&*iter;
+	while (read_8(iter)) ;
+	return cp;
+}
+
+
 template<class T>
 std::string read_pstring(T &iter) {
 	std::string s;
@@ -173,11 +198,14 @@ std::string read_pstring(T &iter) {
 }
 
 
-std::vector<section> read_sections(const std::vector<uint8_t> &section_data) {
+/*
+ * names are left in the file (and interned when the module is merged)
+ * so modules can be parsed in parallel.
+ */
+std::vector<section> read_sections(const uint8_t *iter, const uint8_t *end, std::vector<const char *> &names) {
 
 	std::vector<section> sections;
-	auto iter = section_data.begin();
-	while (iter != section_data.end()) {
+	while (iter != end) {
 
 		section s;
 
@@ -186,7 +214,7 @@ std::vector<section> read_sections(const std::vector<uint8_t> &section_data) {
 		s.size = read_32(iter);
 		s.org = read_32(iter);
 
-		if (!(s.flags & SEC_NONAME)) s.name = read_cstring(iter);
+		names.push_back(s.flags & SEC_NONAME ? "" : skip_cstring(iter));
 
 		sections.emplace_back(std::move(s));
 	}
@@ -194,19 +222,17 @@ std::vector<section> read_sections(const std::vector<uint8_t> &section_data) {
 }
 
 
-std::vector<symbol> read_symbols(const std::vector<uint8_t> &symbol_data) {
+std::vector<symbol> read_symbols(const uint8_t *iter, const uint8_t *end, std::vector<const char *> &names) {
 
 	std::vector<symbol> symbols;
 
-	auto iter = symbol_data.begin();
-	while (iter != symbol_data.end()) {
+	while (iter != end) {
 		symbol s;
 		s.type = read_8(iter);
 		s.flags = read_8(iter);
 		s.section = read_8(iter);
 		s.offset = s.type == S_UND ? 0 : read_32(iter);
-		s.name = read_cstring(iter);
-
+		names.push_back(skip_cstring(iter));
 
 		symbols.emplace_back(std::move(s));
 	}
@@ -215,13 +241,62 @@ std::vector<symbol> read_symbols(const std::vector<uint8_t> &symbol_data) {
 }
 
 
-std::unordered_map<std::string, int> section_map;
+/*
+ * name id -> section/symbol number. ids are dense so this is just a vector.
+ */
+class name_map {
+public:
+	int find(uint32_t id) const {
+		return id < _map.size() ? _map[id] : -1;
+	}
+
+	// does not replace an existing entry.
+	void emplace(uint32_t id, int value) {
+		if (id >= _map.size()) _map.resize(id + 1, -1);
+		if (_map[id] < 0) _map[id] = value;
+	}
+
+private:
+	std::vector<int> _map;
+};
+
+string_pool strings;
+
+name_map section_map;
 std::vector<section> sections;
 
-std::unordered_map<std::string, int> symbol_map;
+name_map symbol_map;
 std::vector<symbol> symbols;
 
-std::set<std::string> undefined_symbols;
+std::set<uint32_t> undefined_symbols;
+
+expr_pool expr_nodes;
+
+/*
+ * expressions which reference a symbol that was undefined when they were
+ * merged, linked (by next) per symbol. simplify() only revisits these.
+ */
+struct symbol_ref {
+	unsigned section;
+	unsigned expression;
+	int next;
+};
+
+std::vector<symbol_ref> symbol_refs;
+std::vector<int> symbol_refs_head; // indexed by symbol number.
+
+void add_symbol_ref(unsigned symbol, unsigned section, unsigned expression) {
+	if (symbol >= symbol_refs_head.size()) symbol_refs_head.resize(symbol + 1, -1);
+
+	int &head = symbol_refs_head[symbol];
+	if (head >= 0) {
+		// same expression referencing the symbol twice.
+		const auto &r = symbol_refs[head];
+		if (r.section == section && r.expression == expression) return;
+	}
+	symbol_refs.push_back(symbol_ref{ section, expression, head });
+	head = symbol_refs.size() - 1;
+}
 
 inline std::string parenthesize(const std::string &s) {
 	std::string tmp;
@@ -232,7 +307,7 @@ inline std::string parenthesize(const std::string &s) {
 }
 
 inline void expr_error(bool fatal, const expression &e, const char *msg) {
-	warnx("%s:%04x %s", sections[e.section].name.c_str(), e.offset, msg);
+	warnx("%s:%04x %s", strings.c_str(sections[e.section].name), e.offset, msg);
 
 	// pretty-print the expression...
 	bool underflow = false;
@@ -242,7 +317,7 @@ inline void expr_error(bool fatal, const expression &e, const char *msg) {
 	std::vector<pair> stack;
 
 	int p;
-	for (auto &x : e.stack) {
+	for (auto &x : expr_nodes[e]) {
 		auto tag = x.tag;
 		switch(tag) {
 
@@ -255,12 +330,12 @@ inline void expr_error(bool fatal, const expression &e, const char *msg) {
 			}
 			case OP_SYM: {
 				p = 0;
-				stack.emplace_back(pair{symbols[x.section].name, p});
+				stack.emplace_back(pair{strings.str(symbols[x.section].name), p});
 				break;
 			}
 			case OP_LOC: {
 				p = 0;
-				std::string tmp = sections[x.section].name;
+				std::string tmp = strings.str(sections[x.section].name);
 				if (x.value) {
 					char buffer[6];
 					snprintf(buffer, sizeof(buffer), "$%02x", x.value);
@@ -370,55 +445,257 @@ inline void expr_error(bool fatal, const expression &e, const char *msg) {
  *
  */
 void simplify() {
-	for (auto &s : sections) {
-		for (auto &e : s.expressions) {
-			bool delta = false;
-
-			// first check for undefined symbols.
-			if (e.undefined) {
-				e.undefined = false;
-				for (auto &t : e.stack) {
-
-					if (t.tag == OP_SYM) {
-						const auto &ss = symbols[t.section];
-						switch(ss.type & 0x0f) {
-							case S_UND:
-								e.undefined = true;
-								break;
-							case S_REL:
-								t = expr{OP_LOC, ss.offset, (uint32_t)ss.section};
-								delta = true;
-								break;
-							case S_ABS:
-								t = expr{OP_VAL, (uint32_t)ss.offset};
-								delta = true;
-								break;
-						}
+	STATS_TIMER(SIMPLIFY);
+
+	for (unsigned i = 0; i < symbol_refs_head.size(); ++i) {
+
+		if ((symbols[i].type & 0x0f) == S_UND) continue;
+
+		for (int r = symbol_refs_head[i]; r >= 0; r = symbol_refs[r].next) {
+			auto &e = sections[symbol_refs[r].section].expressions[symbol_refs[r].expression];
+
+			// already handled via another symbol.
+			if (!e.undefined) continue;
+
+			e.undefined = false;
+			for (auto &t : expr_nodes[e]) {
+
+				if (t.tag == OP_SYM) {
+					const auto &ss = symbols[t.section];
+					switch(ss.type & 0x0f) {
+						case S_UND:
+							e.undefined = true;
+							break;
+						case S_REL:
+							t = expr{OP_LOC, ss.offset, (uint32_t)ss.section};
+							break;
+						case S_ABS:
+							t = expr{OP_VAL, (uint32_t)ss.offset};
+							break;
 					}
 				}
 			}
-			if (e.stack.size() > 1) simplify_expression(e);
+			simplify_expression(expr_nodes, e);
 		}
 	}
 }
 
 
 
+/*
+ * a module that has been parsed but not yet merged into the global
+ * sections and symbol table.  parsing doesn't touch any globals so
+ * modules may be parsed concurrently; merging must be done in order.
+ *
+ * sections, symbols and expression stacks use the module's own
+ * numbering.  data is stored as runs (one per REC_SECT) so merging
+ * lays it out exactly as a single pass would.
+ */
+struct module {
+
+	// a range of the mapped file, or zero fill if data is null.
+	struct chunk {
+		const uint8_t *data;
+		uint32_t size;
+	};
+
+	// chunks [chunk, chunk + chunks) are size bytes of section.
+	struct run {
+		uint8_t section = SECT_CODE;
+		uint32_t chunk = 0;
+		uint32_t chunks = 0;
+		uint32_t size = 0;
+	};
+
+	std::string file;
+	std::string name;
+	Mod_head header;
+	const uint8_t *base = nullptr;
+
+	std::vector<section> sections;
+	std::vector<symbol> symbols;
+
+	// names (in the mapped file) until merged.
+	std::vector<const char *> section_names;
+	std::vector<const char *> symbol_names;
+
+	// data isn't copied until it's merged.
+	std::vector<chunk> data;
+	std::vector<run> runs;
+
+	// expression section is the run, offset is relative to the run.
+	std::vector<expression> expressions;
+	expr_pool nodes;
+	std::vector<bool> malformed;
+};
+
+
 /*
  * read and process all sections...
  * if section > 5, remap based on name.
  *
  */
 
-std::string &upper_case(std::string &s) {
-	std::transform(s.begin(), s.end(), s.begin(), toupper);
-	return s;
+// intern prefix + upper case name.
+uint32_t upper_case(const char *prefix, uint32_t name) {
+	static std::string buffer;
+
+	buffer.assign(prefix);
+	buffer.append(strings.c_str(name), strings.length(name));
+	std::transform(buffer.begin(), buffer.end(), buffer.begin(), toupper);
+	return strings.intern(buffer);
 }
 
-void one_module(const std::vector<uint8_t> &data, 
-	const std::vector<uint8_t> &section_data, 
-	const std::vector<uint8_t> &symbol_data,
-	std::set<std::string> *local_undefined = nullptr) {
+void parse_module(module &m) {
+
+	const auto &h = m.header;
+
+	m.sections = read_sections(m.base + MOD_SEC_OFF(h), m.base + MOD_SYM_OFF(h), m.section_names);
+	m.symbols = read_symbols(m.base + MOD_SYM_OFF(h), m.base + MOD_OPT_OFF(h), m.symbol_names);
+
+	m.runs.emplace_back();
+
+	// cp is null for zero fill.
+	auto add_data = [&m](const uint8_t *cp, uint32_t size) {
+		auto &r = m.runs.back();
+		if (!cp && r.chunks && !m.data.back().data) {
+			m.data.back().size += size;
+		} else {
+			m.data.push_back(module::chunk{cp, size});
+			r.chunks++;
+		}
+		r.size += size;
+	};
+
+	auto iter = m.base + MOD_REC_OFF(h);
+	for(;;) {
+		uint8_t op = read_8(iter);
+		if (op == REC_END) return;
+
+		if (op < 0xf0) {
+			if (op) add_data(iter, op);
+			iter += op;
+			continue;
+		}
+
+		switch(op) {
+			case REC_SPACE: {
+				uint16_t count = read_16(iter);
+				if (count) add_data(nullptr, count);
+				break;
+			}
+
+			case REC_SECT: {
+				/* switch sections */
+				module::run r;
+				r.section = read_8(iter);
+				r.chunk = m.data.size();
+				m.runs.emplace_back(r);
+				break;
+			}
+
+			case REC_ORG: {
+				assert(!"ORG not supported.");
+				break;
+			}
+
+			case REC_RELEXP:
+			case REC_EXPR: {
+
+				expression e;
+				m.nodes.start(e);
+				e.relative = op == REC_RELEXP;
+				e.section = m.runs.size() - 1;
+
+				e.offset = m.runs.back().size;
+				e.size = read_8(iter);
+
+				if (e.size) add_data(nullptr, e.size);
+
+				int reduced_size = 0;
+				/**/
+				for(;;) {
+					op = read_8(iter);
+					if (op == OP_END) break;
+
+					switch(op) {
+						case OP_VAL: {
+							reduced_size++;
+							uint32_t offset = read_32(iter);
+							m.nodes.push(e, expr(op, offset));
+							break;
+						}
+						case OP_SYM: {
+							reduced_size++;
+							uint16_t symbol = read_16(iter);
+							assert(symbol < m.symbols.size());
+							/* section is the local symbol number until merged */
+							m.nodes.push(e, expr(op, 0, symbol));
+							break;
+						}
+						case OP_LOC: {
+							reduced_size++;
+							uint8_t section = read_8(iter);
+							uint32_t offset = read_32(iter);
+							m.nodes.push(e, expr(op, offset, section));
+							break;
+						}
+						// operations..
+						//unary
+						case OP_NOT:
+						case OP_NEG:
+						case OP_FLP:
+							m.nodes.push(e, expr(op));
+							break;
+						// binary
+						case OP_EXP:
+						case OP_MUL:
+						case OP_DIV:
+						case OP_MOD:
+						case OP_SHR:
+						case OP_SHL:
+						case OP_ADD:
+						case OP_SUB:
+						case OP_AND:
+						case OP_OR:
+						case OP_XOR:
+						case OP_EQ:
+						case OP_GT:
+						case OP_LT:
+						case OP_UGT:
+						case OP_ULT:
+							reduced_size--;
+							m.nodes.push(e, expr(op));
+							break;
+						default:
+							assert(!"unsupported expression opcode.");
+					}
+				}
+
+				// fold constants now, while it's still in cache.
+				if (reduced_size == 1) {
+					simplify_expression(m.nodes, e);
+					m.nodes.shrink(e);
+				}
+
+				m.expressions.emplace_back(std::move(e));
+				m.malformed.push_back(reduced_size != 1);
+				break;
+			}
+
+
+			case REC_LINE: break;
+			case REC_DEBUG: {
+				uint16_t size = read_16(iter);
+				iter += size;
+				break;		
+			}
+
+		}
+	}
+}
+
+void merge_module(module &m, std::set<uint32_t> *local_undefined = nullptr) {
 
 	std::array<int, 256> remap_section;
 
@@ -430,14 +707,19 @@ void one_module(const std::vector<uint8_t> &data,
 	remap_section[SECT_DATA] = SECT_DATA;
 	remap_section[SECT_UDATA] = SECT_UDATA;
 
-	std::vector<section> local_sections = read_sections(section_data);
-	std::vector<symbol> local_symbols = read_symbols(symbol_data);
+	std::vector<section> &local_sections = m.sections;
+	std::vector<symbol> &local_symbols = m.symbols;
 
+	for (size_t i = 0; i < local_sections.size(); ++i)
+		local_sections[i].name = strings.intern(m.section_names[i]);
+
+	for (size_t i = 0; i < local_symbols.size(); ++i)
+		local_symbols[i].name = strings.intern(m.symbol_names[i]);
 
 
 	// convert local sections to global 
 	for (auto &s : local_sections) {
-		//printf("section %20s %d\n", s.name.c_str(), s.number);
+		//printf("section %20s %d\n", strings.c_str(s.name), s.number);
 
 		if (s.number <= SECT_UDATA) {
 			sections[s.number].size += s.size; // for page0 / udata sections.
@@ -447,8 +729,8 @@ void one_module(const std::vector<uint8_t> &data,
 
 		// todo -- should install section name as global symbol?
 
-		auto iter = section_map.find(s.name);
-		if (iter == section_map.end()) {
+		int index = section_map.find(s.name);
+		if (index < 0) {
 
 			int virtual_section = sections.size();
 			remap_section[s.number] = virtual_section;
@@ -459,15 +741,13 @@ void one_module(const std::vector<uint8_t> &data,
 
 				symbol sym;
 
-				sym.name = "_BEG_" + s.name;
-				upper_case(sym.name);
+				sym.name = upper_case("_BEG_", s.name);
 				sym.section = virtual_section;
 				sym.type = S_REL; // check if section has offset?
 				sym.flags = SF_DEF | SF_GBL;
 
 
-				auto iter = symbol_map.find(sym.name);
-				if (iter == symbol_map.end()) {
+				if (symbol_map.find(sym.name) < 0) {
 					symbol_map.emplace(sym.name, symbols.size());
 					symbols.emplace_back(std::move(sym));
 				} else {
@@ -493,15 +773,13 @@ void one_module(const std::vector<uint8_t> &data,
 				}
 */
 
-				sym.name = "_END_" + s.name;
-				upper_case(sym.name);
+				sym.name = upper_case("_END_", s.name);
 
 				sym.section = symbols.size();
 				sym.type = S_UND;
 				sym.flags = 0;
 
-				iter = symbol_map.find(sym.name);
-				if (iter == symbol_map.end()) {
+				if (symbol_map.find(sym.name) < 0) {
 					s.end_symbol = sym.section;
 					symbol_map.emplace(sym.name, sym.section);
 					symbols.emplace_back(std::move(sym));	
@@ -517,10 +795,10 @@ void one_module(const std::vector<uint8_t> &data,
 			section_map.emplace(s.name, virtual_section);
 
 		} else {
-			auto &ss = sections[iter->second];
+			auto &ss = sections[index];
 			assert(ss.flags == s.flags); // check org????
-			remap_section[s.number] = iter->second;
-			s.number = iter->second;
+			remap_section[s.number] = index;
+			s.number = index;
 
 			// update size (for ref-only sections)
 			ss.size += s.size;
@@ -537,24 +815,24 @@ void one_module(const std::vector<uint8_t> &data,
 			if (s.type == S_UND) status = "extern";
 			else if (s.flags & SF_GBL) status = "public";
 			else status = "private";
-			fprintf(stderr, "  %-20s [%s]\n", s.name.c_str(), status);
+			fprintf(stderr, "  %-20s [%s]\n", strings.c_str(s.name), status);
 		}
 
 		if (s.type == S_UND) {
 
 
-			auto iter = symbol_map.find(s.name);
-			if (iter == symbol_map.end()) {
+			int index = symbol_map.find(s.name);
+			if (index < 0) {
 				s.section = symbols.size();
 				symbol_map.emplace(s.name, s.section);
 				symbols.emplace_back(s);
 				undefined_symbols.emplace(s.name);
 
-				fprintf(stderr, "Adding %s to undefined symbols\n", s.name.c_str());
+				fprintf(stderr, "Adding %s to undefined symbols\n", strings.c_str(s.name));
 			}
 			else {
 				// already exists... 
-				const auto &ss = symbols[iter->second];
+				const auto &ss = symbols[index];
 				/* if (ss.type != S_UND) */
 				// always copy over since s.section is a big deal.
 				s = ss;
@@ -581,14 +859,14 @@ void one_module(const std::vector<uint8_t> &data,
 		constexpr const unsigned mask = SF_GBL | SF_DEF;
 		if ((s.flags & mask) == mask) {
 
-			auto iter = symbol_map.find(s.name);
+			int index = symbol_map.find(s.name);
 
-			if (iter == symbol_map.end()) {
+			if (index < 0) {
 				unsigned tmp = symbols.size();
 				symbol_map.emplace(s.name, tmp);
 				symbols.emplace_back(s);
 			} else {
-				auto &ss = symbols[iter->second];
+				auto &ss = symbols[index];
 
 				// if it was undefined, define it!
 				if (ss.type == S_UND) {
@@ -598,7 +876,7 @@ void one_module(const std::vector<uint8_t> &data,
 				else {
 					// ok if symbols are identical..
 					if (ss.type != s.type || ss.flags != s.flags || ss.section != s.section || ss.offset != s.offset) {
-						warnx("Duplicate label %s", s.name.c_str());
+						warnx("Duplicate label %s", strings.c_str(s.name));
 						flags.errors++;
 					} 
 				}
@@ -606,154 +884,76 @@ void one_module(const std::vector<uint8_t> &data,
 
 		}
 
-	}
-
-	// set it here. sections may be resized above.
-	int current_section = SECT_CODE;
-	std::vector<uint8_t> *data_ptr = &sections[current_section].data;
-
-
-	auto iter = data.begin();
-	for(;;) {
-		uint8_t op = read_8(iter);
-		if (op == REC_END) return;
-
-		if (op < 0xf0) {
-			data_ptr->insert(data_ptr->end(), iter, iter + op);
-			iter += op;
-			continue;
-		}
-
-		switch(op) {
-			case REC_SPACE: {
-				uint16_t count = read_16(iter);
-				data_ptr->insert(data_ptr->end(), count, 0);
-				break;
-			}
-
-			case REC_SECT: {
-				/* switch sections */
-				uint8_t s = read_8(iter);
-				current_section = remap_section[s];
-				assert(current_section > 0 && current_section < sections.size());
-
-				data_ptr = &sections[current_section].data;
-				break;
-			}
-
-			case REC_ORG: {
-				assert(!"ORG not supported.");
-				break;
-			}
-
-			case REC_RELEXP:
-			case REC_EXPR: {
-
-				expression e;
-				e.relative = op == REC_RELEXP;
-				e.section = current_section;
-
-				e.offset =  data_ptr->size();
-				e.size = read_8(iter);
-
-
-				data_ptr->insert(data_ptr->end(), e.size, 0);
-
-				int reduced_size = 0;
-				/**/
-				for(;;) {
-					op = read_8(iter);
-					if (op == OP_END) break;
-
-					switch(op) {
-						case OP_VAL: {
-							reduced_size++;
-							uint32_t offset = read_32(iter);
-							e.stack.emplace_back(op, offset);
-							break;
-						}
-						case OP_SYM: {
-							reduced_size++;
-							uint16_t symbol = read_16(iter);
-							assert(symbol < local_symbols.size());
-							auto &s = local_symbols[symbol];
-							switch (s.type & 0x0f) {
-								case S_UND:
-									// S_UND indicates it's still undefined globally.
-									e.stack.emplace_back(OP_SYM, 0, s.section); /* section is actually a symbol number */
-									e.undefined = true;
-									break;
-
-								case S_REL:
-									e.stack.emplace_back(OP_LOC, s.offset, s.section);
-									break;
-
-								case S_ABS:
-									e.stack.emplace_back(OP_VAL, s.offset);
-									break;
-
-								default:
-									assert(!"unsupported symbol flags.");
-							}
-							break;
-						}
-						case OP_LOC: {
-							reduced_size++;
-							uint8_t section = read_8(iter);
-							uint32_t offset = read_32(iter);
-							int real_section = remap_section[section];
-							assert(real_section >= 0);
-							e.stack.emplace_back(op, offset, real_section);
-							break;
-						}
-						// operations..
-						//unary
-						case OP_NOT:
-						case OP_NEG:
-						case OP_FLP:
-							e.stack.emplace_back(op);
-							break;
-						// binary
-						case OP_EXP:
-						case OP_MUL:
-						case OP_DIV:
-						case OP_MOD:
-						case OP_SHR:
-						case OP_SHL:
-						case OP_ADD:
-						case OP_SUB:
-						case OP_AND:
-						case OP_OR:
-						case OP_XOR:
-						case OP_EQ:
-						case OP_GT:
-						case OP_LT:
-						case OP_UGT:
-						case OP_ULT:
-							reduced_size--;
-							e.stack.emplace_back(op);
-							break;
-						default:
-							assert(!"unsupported expression opcode.");
-					}
-				}
+	}
+
+	// set it here. sections may be resized above.
+	std::vector<unsigned> run_section;
+	std::vector<uint32_t> run_offset;
+	run_section.reserve(m.runs.size());
+	run_offset.reserve(m.runs.size());
+
+	for (const auto &r : m.runs) {
+		int current_section = remap_section[r.section];
+		assert(current_section > 0 && current_section < sections.size());
+
+		auto &data = sections[current_section].data;
+		run_section.push_back(current_section);
+		run_offset.push_back(data.size());
+
+		for (uint32_t i = r.chunk; i < r.chunk + r.chunks; ++i) {
+			const auto &c = m.data[i];
+			if (c.data) data.insert(data.end(), c.data, c.data + c.size);
+			else data.insert(data.end(), c.size, (uint8_t)0);
+		}
+	}
 
-				if (reduced_size != 1) {
-					expr_error(true, e, "Malformed expression");
+	for (size_t i = 0; i < m.expressions.size(); ++i) {
+
+		expression &e = m.expressions[i];
+		unsigned run = e.section;
+		e.section = run_section[run];
+		e.offset += run_offset[run];
+
+		unsigned index = sections[e.section].expressions.size();
+
+		auto nodes = m.nodes[e];
+		for (auto &t : nodes) {
+			if (t.tag == OP_SYM) {
+				auto &s = local_symbols[t.section];
+				switch (s.type & 0x0f) {
+					case S_UND:
+						// S_UND indicates it's still undefined globally.
+						t = expr{OP_SYM, 0, (uint32_t)s.section}; /* section is actually a symbol number */
+						e.undefined = true;
+						add_symbol_ref(s.section, e.section, index);
+						break;
+
+					case S_REL:
+						t = expr{OP_LOC, s.offset, (uint32_t)s.section};
+						break;
+
+					case S_ABS:
+						t = expr{OP_VAL, s.offset};
+						break;
+
+					default:
+						assert(!"unsupported symbol flags.");
 				}
-				sections[current_section].expressions.emplace_back(std::move(e));
-				break;
+				continue;
 			}
-
-
-			case REC_LINE: break;
-			case REC_DEBUG: {
-				uint16_t size = read_16(iter);
-				iter += size;
-				break;		
+			if (t.tag == OP_LOC) {
+				int real_section = remap_section[t.section];
+				assert(real_section >= 0);
+				t.section = real_section;
 			}
+		}
+		expr_nodes.assign(e, nodes.begin(), nodes.end());
 
+		if (m.malformed[i]) {
+			expr_error(true, e, "Malformed expression");
 		}
+		STATS_ADD(EXPRESSIONS, 1);
+		sections[e.section].expressions.emplace_back(std::move(e));
 	}
 }
 
@@ -769,23 +969,23 @@ void init() {
 
 	sections[SECT_PAGE0].number = SECT_PAGE0;
 	sections[SECT_PAGE0].flags = SEC_DATA | SEC_NONAME | SEC_DIRECT | SEC_REF_ONLY;
-	sections[SECT_PAGE0].name = "page0";
+	sections[SECT_PAGE0].name = strings.intern("page0");
 
 	sections[SECT_CODE].number = SECT_CODE;
 	sections[SECT_CODE].flags = SEC_NONAME;
-	sections[SECT_CODE].name = "code"; 
+	sections[SECT_CODE].name = strings.intern("code"); 
 
 	sections[SECT_KDATA].number = SECT_KDATA;
 	sections[SECT_KDATA].flags = SEC_DATA | SEC_NONAME;
-	sections[SECT_KDATA].name = "kdata"; 
+	sections[SECT_KDATA].name = strings.intern("kdata"); 
 
 	sections[SECT_DATA].number = SECT_DATA;
 	sections[SECT_DATA].flags = SEC_DATA | SEC_NONAME;
-	sections[SECT_DATA].name = "data"; 
+	sections[SECT_DATA].name = strings.intern("data"); 
 
 	sections[SECT_UDATA].number = SECT_UDATA;
 	sections[SECT_UDATA].flags = SEC_DATA | SEC_NONAME | SEC_REF_ONLY;
-	sections[SECT_UDATA].name = "udata"; 
+	sections[SECT_UDATA].name = strings.intern("udata"); 
 
 	/*
 	 * For each section, [the linker] creates three symbols, 
@@ -797,7 +997,7 @@ void init() {
 
 	// n.b - only for pre-defined sections [?], skip the _ROM_BEG_* symbols...
 
-	static std::string names[] = {
+	static const char *names[] = {
 			"_BEG_PAGE0", "_END_PAGE0",
 			"_BEG_CODE", "_END_CODE",
 			"_BEG_KDATA", "_END_KDATA",
@@ -809,7 +1009,7 @@ void init() {
 
 		// begin is 0.
 		symbol s;
-		s.name = names[i * 2];
+		s.name = strings.intern(names[i * 2]);
 		s.section = i;
 		s.type = S_REL;
 		s.flags = SF_DEF | SF_GBL;
@@ -817,7 +1017,7 @@ void init() {
 		symbols.emplace_back(s);
 
 		// end is undefined...
-		s.name = names[i * 2 + 1];
+		s.name = strings.intern(names[i * 2 + 1]);
 		s.section = i * 2 + 1; // symbol number.
 		s.type = S_UND;
 		s.flags = 0;
@@ -833,14 +1033,25 @@ void init() {
 
 }
 
+/*
+ * name ids in alphabetical order (for messages).
+ */
+std::vector<uint32_t> sorted_names(const std::set<uint32_t> &names) {
+	std::vector<uint32_t> rv(names.begin(), names.end());
+	std::sort(rv.begin(), rv.end(), [](uint32_t a, uint32_t b){
+		return strcmp(strings.c_str(a), strings.c_str(b)) < 0;
+	});
+	return rv;
+}
+
 /*
  * add and return an undefined symbol. if known, adds it to the missing set.
  * if symbol is already defined, returns it.
  */
-symbol &reserve_symbol(const std::string &name, bool open = true) {
+symbol &reserve_symbol(uint32_t name, bool open = true) {
 
-	auto iter = symbol_map.find(name);
-	if (iter != symbol_map.end()) return symbols[iter->second];
+	int index = symbol_map.find(name);
+	if (index >= 0) return symbols[index];
 
 	if (open) undefined_symbols.emplace(name);
 	else undefined_symbols.erase(name);
@@ -858,6 +1069,7 @@ symbol &reserve_symbol(const std::string &name, bool open = true) {
 }
 
 void generate_end() {
+	STATS_TIMER(GENERATE_END);
 
 /*
 	const std::string names[] = {
@@ -886,10 +1098,10 @@ void generate_end() {
 		// if there is an undefined symbol matching the section name, add it.
 		if ((s.flags & SEC_NONAME) == 0) {
 
-			auto iter = symbol_map.find(s.name);
-			if (iter != symbol_map.end()) {
+			int index = symbol_map.find(s.name);
+			if (index >= 0) {
 
-				symbol &sym = symbols[iter->second];
+				symbol &sym = symbols[index];
 				if (sym.type == S_UND) {
 					undefined_symbols.erase(s.name);
 					sym.section = s.number;
@@ -955,7 +1167,9 @@ inline bool in_range(int value, int low, int high) {
 }
 
 void to_omf(const expression &e, omf::segment &seg) {
-	if (e.stack.empty() || e.size == 0) {
+	auto stack = expr_nodes[e];
+
+	if (stack.empty() || e.size == 0) {
 		expr_error(false, e, "Expression empty");
 		return;
 	}
@@ -965,44 +1179,44 @@ void to_omf(const expression &e, omf::segment &seg) {
 	}
 
 
-	if (e.stack.size() == 1) {
-		auto &a = e.stack[0];
+	switch (e.kind) {
 
-		uint32_t value = a.value;
+		case FIXUP_RELATIVE: {
+			uint32_t value = stack[0].value;
+			uint32_t pc = e.offset;
 
-		if (e.relative) {
-			if (a.tag == OP_VAL || a.tag == OP_LOC) {
-
-				int tmp = (int)value - (int)e.offset - (int)e.size;
-				bool ok = false;
-
-				if (e.size >= 2 && in_range(tmp, -32768, 32767)) ok = true;
-				if (e.size == 1 && in_range(tmp, -128, 127)) ok = true;
+			if (flags.H) {
+				// everything has a fixed address, so branches may cross sections.
+				if (stack[0].tag == OP_LOC) value += omf_segments.at(stack[0].section - 1).org;
+				pc += seg.org;
+			}
 
-				if (!ok) {
-					expr_error(true, e, "Relative branch out of range");
-					return;					
-				}
+			int tmp = (int)value - (int)pc - (int)e.size;
+			bool ok = false;
 
-				for (int i = 0; i < e.size; ++i, tmp >>= 8)
-					seg.data[e.offset + i] = tmp & 0xff;
+			if (e.size >= 2 && in_range(tmp, -32768, 32767)) ok = true;
+			if (e.size == 1 && in_range(tmp, -128, 127)) ok = true;
 
-				return;
+			if (!ok) {
+				expr_error(true, e, "Relative branch out of range");
+				return;					
 			}
 
-			expr_error(true, e, "Relative expression too complex");
+			for (int i = 0; i < e.size; ++i, tmp >>= 8)
+				seg.data[e.offset + i] = tmp & 0xff;
+
 			return;
 		}
 
-
-		if (a.tag == OP_VAL) {
+		case FIXUP_VALUE: {
+			uint32_t value = stack[0].value;
 			for (int i = 0; i < e.size; ++i, value >>= 8)
 				seg.data[e.offset + i] = value & 0xff;
 			return;
 		}
 
-		if (a.tag == OP_LOC) {
-			auto &loc = a;
+		case FIXUP_LOC: {
+			auto &loc = stack[0];
 
 			if (loc.section == 0) {
 				expr_error(true, e, "Invalid segment");
@@ -1013,7 +1227,7 @@ void to_omf(const expression &e, omf::segment &seg) {
 				omf::reloc r;
 				r.size = e.size;
 				r.offset = e.offset;
-				r.value = value;
+				r.value = loc.value;
 
 				seg.relocs.emplace_back(r);
 			} else {
@@ -1030,18 +1244,10 @@ void to_omf(const expression &e, omf::segment &seg) {
 			return;
 		}
 
-		// error handled below.
-	}
-
-
-
-	if (e.stack.size() == 3) {
-		auto &loc = e.stack[0];
-		auto &shift = e.stack[1];
-		auto &op = e.stack[2];
-
-		if (loc.tag == OP_LOC && shift.tag == OP_VAL && (op.tag == OP_SHL || op.tag == OP_SHR)) {
-
+		case FIXUP_SHIFT: {
+			auto &loc = stack[0];
+			auto &shift = stack[1];
+			auto &op = stack[2];
 
 			if (shift.value > 24) {
 				expr_error(false, e, "Shift too large");
@@ -1091,6 +1297,10 @@ void to_omf(const expression &e, omf::segment &seg) {
 		}
 	}
 
+	if (e.relative && stack.size() == 1) {
+		expr_error(true, e, "Relative expression too complex");
+		return;
+	}
 
 	expr_error(true, e, "Expression too complex");
 	// should also pretty-print the expression.
@@ -1099,7 +1309,108 @@ void to_omf(const expression &e, omf::segment &seg) {
 }
 
 
+/*
+ * -P: pack the code sections (other than CODE) into as few bank-sized
+ * segments as possible.  Sections that reference each other are clustered
+ * first (so those references become relocs rather than intersegs), then the
+ * clusters are packed first-fit decreasing.  bins[0] is appended to the code
+ * segment, which is already code_size bytes.  sections larger than a bank
+ * have already been rejected.
+ */
+std::vector< std::vector<unsigned> > pack_sections(uint32_t code_size) {
+
+	constexpr uint32_t bank = 0x10000;
+
+	std::vector<unsigned> parent(sections.size());
+	std::vector<uint32_t> size(sections.size());
+	std::vector<bool> packable(sections.size());
+
+	for (const auto &s : sections) {
+		parent[s.number] = s.number;
+		if (s.flags & (SEC_REF_ONLY | SEC_DATA)) continue;
+		if (s.number == SECT_CODE) {
+			size[s.number] = code_size;
+		} else {
+			size[s.number] = s.data.size();
+		}
+		packable[s.number] = size[s.number] <= bank;
+	}
+
+	auto find = [&](unsigned x) {
+		while (parent[x] != x) x = parent[x] = parent[parent[x]];
+		return x;
+	};
+
+	// reference graph
+	std::map< std::pair<unsigned, unsigned>, uint32_t > weights;
+	for (const auto &s : sections) {
+		if (!packable[s.number]) continue;
+		for (const auto &e : s.expressions) {
+			for (const auto &t : expr_nodes[e]) {
+				if (t.tag != OP_LOC) continue;
+				unsigned other = t.section;
+				if (other == s.number || other >= sections.size() || !packable[other]) continue;
+				weights[std::minmax(s.number, other)]++;
+			}
+		}
+	}
+
+	std::vector< std::pair<std::pair<unsigned, unsigned>, uint32_t> > edges(weights.begin(), weights.end());
+	std::stable_sort(edges.begin(), edges.end(), [](const auto &a, const auto &b){
+		return a.second > b.second;
+	});
+
+	for (const auto &e : edges) {
+		unsigned a = find(e.first.first);
+		unsigned b = find(e.first.second);
+		if (a == b || size[a] + size[b] > bank) continue;
+		// keep CODE as the root of its cluster.
+		if (b == SECT_CODE) std::swap(a, b);
+		parent[b] = a;
+		size[a] += size[b];
+	}
+
+	// clusters, in section order.
+	std::map<unsigned, std::vector<unsigned> > clusters;
+	for (const auto &s : sections) {
+		if (!packable[s.number] || s.number == SECT_CODE) continue;
+		clusters[find(s.number)].push_back(s.number);
+	}
+
+	std::vector< std::vector<unsigned> > bins(1);
+	std::vector<uint32_t> used(1, packable[SECT_CODE] ? size[SECT_CODE] : bank);
+
+	std::vector<unsigned> roots;
+	for (const auto &kv : clusters) roots.push_back(kv.first);
+	std::stable_sort(roots.begin(), roots.end(), [&](unsigned a, unsigned b){
+		return size[a] > size[b];
+	});
+
+	for (unsigned r : roots) {
+		auto &c = clusters[r];
+		if (r == SECT_CODE) {
+			append(bins[0], c);
+			continue;
+		}
+		size_t i = 0;
+		while (i < bins.size() && used[i] + size[r] > bank) ++i;
+		if (i == bins.size()) {
+			bins.emplace_back();
+			used.push_back(0);
+		}
+		append(bins[i], c);
+		used[i] += size[r];
+	}
+
+	for (auto &b : bins) std::sort(b.begin(), b.end());
+	std::sort(bins.begin() + 1, bins.end());
+	return bins;
+}
+
+void resolve_expressions(const std::vector< std::pair<unsigned, uint32_t> > &remap);
+
 void build_omf_segments() {
+	STATS_TIMER(BUILD_OMF);
 
 
 	std::vector< std::pair<unsigned, uint32_t> > remap;
@@ -1176,23 +1487,53 @@ void build_omf_segments() {
 		// data_seg no longer valid since emplace_back() may invalidate.
 	}
 
-	// for all other sections, create a new segment.
-	for (auto &s : sections) {
-		if (s.flags & SEC_REF_ONLY) continue;
-		if (s.flags & SEC_DATA) continue;
-		if (s.number == SECT_CODE) continue;
+	// the loader can't place a code segment that crosses a bank.  -P promises
+	// loadable segments, so it's an error there.
+	for (const auto &s : sections) {
+		if (s.flags & (SEC_REF_ONLY | SEC_DATA)) continue;
+		if (s.data.size() <= 0x10000 || s.number == SECT_CODE) continue;
+		if (flags.P)
+			errx(EX_DATAERR, "Section %s is larger than a bank ($%06x bytes)", strings.c_str(s.name), (uint32_t)s.data.size());
+		warnx("Section %s is larger than a bank ($%06x bytes)", strings.c_str(s.name), (uint32_t)s.data.size());
+	}
+	if (omf_segments[code_segment-1].data.size() > 0x10000) {
+		if (flags.P)
+			errx(EX_DATAERR, "Code segment is larger than a bank ($%06x bytes)", (uint32_t)omf_segments[code_segment-1].data.size());
+		warnx("Code segment is larger than a bank ($%06x bytes)", (uint32_t)omf_segments[code_segment-1].data.size());
+	}
 
+	// for all other sections, create a new segment (or pack them with -P).
+	std::vector< std::vector<unsigned> > bins(1);
+	if (flags.P) {
+		bins = pack_sections(omf_segments[code_segment-1].data.size());
+	} else {
+		for (const auto &s : sections) {
+			if (s.flags & (SEC_REF_ONLY | SEC_DATA)) continue;
+			if (s.number == SECT_CODE) continue;
+			bins.emplace_back(1, s.number);
+		}
+	}
 
-		omf_segments.emplace_back();
-		auto &seg = omf_segments.back();
+	for (size_t i = 0; i < bins.size(); ++i) {
+		if (bins[i].empty()) continue;
 
-		seg.segnum = omf_segments.size();
-		seg.kind = 0x0000; // static code.
-		seg.data = std::move(s.data);
-		seg.segname = s.name;
-		s.data.clear();
+		unsigned segnum = code_segment;
+		if (i) {
+			omf_segments.emplace_back();
+			auto &seg = omf_segments.back();
+
+			segnum = seg.segnum = omf_segments.size();
+			seg.kind = 0x0000; // static code.
+			seg.segname = strings.str(sections[bins[i].front()].name);
+		}
 
-		remap[s.number] = std::make_pair(seg.segnum, 0);
+		auto &seg = omf_segments[segnum-1];
+		for (unsigned n : bins[i]) {
+			auto &s = sections[n];
+			remap[s.number] = std::make_pair(segnum, seg.data.size());
+			append(seg.data, s.data);
+			s.data.clear();
+		}
 	}
 
 
@@ -1224,7 +1565,15 @@ void build_omf_segments() {
 		}
 	}
 
-	// now adjust all the expressions, simplify, and convert to reloc records.
+	resolve_expressions(remap);
+}
+
+/*
+ * now adjust all the expressions (remap is section -> segment, offset),
+ * simplify, and convert to reloc records.
+ */
+void resolve_expressions(const std::vector< std::pair<unsigned, uint32_t> > &remap) {
+
 	for (auto &s :sections) {
 
 		auto &x = remap[s.number];
@@ -1233,37 +1582,169 @@ void build_omf_segments() {
 
 			e.offset += x.second;
 
-			for (auto &t : e.stack) {
+			for (auto &t : expr_nodes[e]) {
 				if (t.tag == OP_LOC) {
 					const auto &x = remap[t.section];
 					t.section = x.first;
 					t.value += x.second;
 				}
 			}
-			simplify_expression(e);
+			// anything else was simplified when parsed (or when its symbols were resolved).
+			if (e.kind == FIXUP_COMPLEX) simplify_expression(expr_nodes, e);
 
 			unsigned segnum = remap[s.number].first;
 			to_omf(e, omf_segments.at(segnum-1));
 		}
 	}
+}
+
+
+/*
+ * -H: one segment per section, each at a fixed address (-A, otherwise
+ * right after the previous section).  Code and initialized data come
+ * first, uninitialized sections last; page0 is at 0 unless placed.
+ * save_bin() resolves the relocations.
+ */
+void build_bin_segments() {
+	STATS_TIMER(BUILD_OMF);
+
+	std::vector< std::pair<unsigned, uint32_t> > remap;
+	remap.resize(sections.size());
+
+	std::vector<optional<uint32_t>> address(sections.size());
+	for (const auto &a : flags.A) {
+		auto iter = std::find_if(sections.begin(), sections.end(), [&](const section &s){
+			return !strcasecmp(strings.c_str(s.name), a.first.c_str());
+		});
+		if (iter == sections.end()) {
+			warnx("-A: no section named %s", a.first.c_str());
+			continue;
+		}
+		address[iter->number] = optional<uint32_t>(a.second);
+	}
+	if (!address[SECT_PAGE0]) address[SECT_PAGE0] = optional<uint32_t>(0);
+
+	std::vector<unsigned> order;
+	for (const auto &s : sections)
+		if (!(s.flags & SEC_REF_ONLY)) order.push_back(s.number);
+	for (const auto &s : sections)
+		if ((s.flags & SEC_REF_ONLY) && s.number != SECT_PAGE0) order.push_back(s.number);
+	order.push_back(SECT_PAGE0);
+
+	uint32_t pc = 0;
+	for (unsigned n : order) {
+		auto &s = sections[n];
+
+		omf_segments.emplace_back();
+		auto &seg = omf_segments.back();
+		seg.segnum = omf_segments.size();
+		seg.kind = s.flags & SEC_DATA ? 0x0001 : 0x0000;
+		if (n == SECT_PAGE0) seg.kind = 0x12; // direct page, not part of the image.
+		seg.segname = strings.str(s.name);
+
+		if (address[n]) pc = *address[n];
+		seg.org = pc;
+
+		if (s.flags & SEC_REF_ONLY) {
+			seg.reserved_space = s.size;
+		} else {
+			seg.data = std::move(s.data);
+			s.data.clear();
+		}
+		uint32_t size = seg.data.size() + seg.reserved_space;
+		if (n != SECT_PAGE0) pc += size;
+
+		if (!(s.flags & SEC_DATA) && size && (seg.org >> 16) != ((seg.org + size - 1) >> 16))
+			warnx("Section %s crosses a bank boundary ($%06x-$%06x)", seg.segname.c_str(), seg.org, seg.org + size - 1);
+
+		if (flags.v) printf("section %-20s $%06x $%06x\n", seg.segname.c_str(), seg.org, size);
+
+		remap[n] = std::make_pair(seg.segnum, 0);
+	}
+	if (flags.v) fputs("\n", stdout);
+
+	resolve_expressions(remap);
+}
 
-	// and we're done...
+/*
+ * SUPER INTERSEG13-36 only work for segments 1-12 (1-11 with ExpressLoad,
+ * which inserts itself as segment 1). Move the segments with the most
+ * 2-byte intersegment references into those numbers. The code segment stays
+ * first; otherwise the original order is kept.
+ */
+void renumber_segments() {
+
+	if (flags.omf_flags & (OMF_V1 | OMF_NO_SUPER)) return;
+
+	unsigned limit = flags.omf_flags & OMF_NO_EXPRESS ? 12 : 11;
+	unsigned count = omf_segments.size();
+	if (count <= limit) return;
+
+	std::vector<uint32_t> refs(count + 1);
+	for (const auto &seg : omf_segments) {
+		for (const auto &r : seg.intersegs) {
+			if (r.size == 2 && (r.shift == 0 || r.shift == 0xf0) && r.segment <= count)
+				refs[r.segment]++;
+		}
+		// bank of the current segment.
+		for (const auto &r : seg.relocs) {
+			if (r.size == 2 && r.shift == 0xf0)
+				refs[seg.segnum]++;
+		}
+	}
 
+	std::vector<unsigned> hot;
+	for (unsigned i = 2; i <= count; ++i) {
+		if (refs[i]) hot.push_back(i);
+	}
+	std::stable_sort(hot.begin(), hot.end(), [&](unsigned a, unsigned b){
+		return refs[a] > refs[b];
+	});
+	if (hot.size() > limit - 1) hot.resize(limit - 1);
+	if (hot.empty() || *std::max_element(hot.begin(), hot.end()) <= limit) return;
+	std::sort(hot.begin(), hot.end());
+
+	std::vector<unsigned> order; // new -> old
+	std::vector<unsigned> map(count + 1); // old -> new
+	order.push_back(1);
+	order.insert(order.end(), hot.begin(), hot.end());
+	for (unsigned i = 2; i <= count; ++i) {
+		if (!std::binary_search(hot.begin(), hot.end(), i)) order.push_back(i);
+	}
+	for (unsigned i = 0; i < count; ++i) map[order[i]] = i + 1;
+
+	std::vector<omf::segment> tmp;
+	tmp.reserve(count);
+	for (unsigned old : order) {
+		tmp.emplace_back(std::move(omf_segments[old - 1]));
+		auto &seg = tmp.back();
+		seg.segnum = map[old];
+		for (auto &r : seg.intersegs) {
+			if (r.segment <= count) r.segment = map[r.segment];
+		}
+	}
+	omf_segments = std::move(tmp);
 }
 
 
-bool one_module(const std::string &name, int fd, std::set<std::string> *local_undefined = nullptr) {
+/*
+ * locate the module at offset and advance offset past it.
+ * returns false at end of file or if the module is invalid.
+ */
+bool find_module(const std::string &name, const mapped_file &file, size_t &offset, module &m) {
 	Mod_head h;
-	ssize_t ok;
 
-	ok = read(fd, &h, sizeof(h));
-	if (ok == 0) return false;
+	if (offset >= file.size()) return false;
 
-	if (ok < sizeof(h)) {
+	size_t available = file.size() - offset;
+	if (available < sizeof(h)) {
 		warnx("Invalid object file: %s", name.c_str());
-		return false;;
+		return false;
 	}
 
+	const uint8_t *base = file.data() + offset;
+	memcpy(&h, base, sizeof(h));
+
 	le_to_host(h.h_magic);
 	le_to_host(h.h_version);
 	le_to_host(h.h_filtyp);
@@ -1280,78 +1761,66 @@ bool one_module(const std::string &name, int fd, std::set<std::string> *local_un
 	assert(h.h_version == 1);
 	assert(h.h_filtyp == 1);
 
-
-	std::string module_name;
-	{
-		// now read the name (h_namlen includes 0 terminator.)
-		std::vector<char> tmp;
-		tmp.resize(h.h_namlen);
-		ok = read(fd, tmp.data(), h.h_namlen);
-		if (ok != h.h_namlen) {
-			warnx("Invalid object file: %s", name.c_str());
-			return false;
-		}
-		module_name.assign(tmp.data());
-	}
-
-	std::vector<uint8_t> record_data;
-	std::vector<uint8_t> symbol_data;
-	std::vector<uint8_t> section_data;
-
-	record_data.resize(h.h_recsize);
-	ok = read(fd, record_data.data(), h.h_recsize);
-	if (ok != h.h_recsize) {
-		warnx("Truncated object file: %s", name.c_str());
+	// h_namlen includes 0 terminator.
+	if (available < MOD_REC_OFF(h)) {
+		warnx("Invalid object file: %s", name.c_str());
 		return false;
 	}
-
-	section_data.resize(h.h_secsize);
-	ok = read(fd, section_data.data(), h.h_secsize);
-	if (ok != h.h_secsize) {
+	if (available < MOD_OPT_OFF(h)) {
 		warnx("Truncated object file: %s", name.c_str());
 		return false;
 	}
 
-	symbol_data.resize(h.h_symsize);
-	ok = read(fd, symbol_data.data(), h.h_symsize);
-	if (ok != h.h_symsize)  {
-		warnx("Truncated object file: %s", name.c_str());
-		return false;
-	}
+	const char *cp = (const char *)base + sizeof(h);
+	m.file = name;
+	m.name.assign(cp, strnlen(cp, h.h_namlen));
+	m.header = h;
+	m.base = base;
 
-	if (flags.v) {
-		printf("Processing %s:%s\n", name.c_str(), module_name.c_str());
-	}
+	offset += std::min(available, (size_t)MOD_NEXT_OFF(h));
 
-	// should probably pass in name and module....
-	one_module(record_data, section_data, symbol_data, local_undefined);
-	
+	return true;
+}
 
-	if (h.h_optsize) lseek(fd, h.h_optsize, SEEK_CUR);
+/*
+ * parse the modules (in parallel with -j) then merge them in order.
+ */
+void load_modules(std::vector<module> &modules, std::set<uint32_t> *local_undefined = nullptr) {
 
-	return true;
+	parallel_for(modules.size(), flags.j, [&](size_t i){
+		parse_module(modules[i]);
+	});
+
+	for (auto &m : modules) {
+		if (flags.v) {
+			printf("Processing %s:%s\n", m.file.c_str(), m.name.c_str());
+		}
+		merge_module(m, local_undefined);
+		m = module();
+		STATS_ADD(MODULES, 1);
+	}
 }
 
-bool one_file(const std::string &name) {
+/*
+ * open an object file and queue up its modules.
+ * file must remain open until they've been loaded.
+ */
+bool one_file(const std::string &name, mapped_file &file, std::vector<module> &modules) {
 
 	if (flags.v) printf("Processing %s\n", name.c_str());
 
-	int fd = open(name.c_str(), O_RDONLY | O_BINARY);
-	if (fd < 0) {
+	if (!file.open(name)) {
 		warn("Unable to open %s", name.c_str());
 		return false;
 	}
-	bool rv = false;
 
 	Header h;
-	ssize_t ok;
 
-	ok = read(fd, &h, sizeof(h));
-	if (ok != sizeof(h)) {
+	if (file.size() < sizeof(h)) {
 		warnx("Invalid object file: %s", name.c_str());
-		close(fd);
 		return false;
 	}
+	memcpy(&h, file.data(), sizeof(h));
 
 	le_to_host(h.magic);
 	le_to_host(h.version);
@@ -1359,21 +1828,22 @@ bool one_file(const std::string &name) {
 
 	if (h.magic != MOD_MAGIC || h.version != MOD_VERSION || h.filetype < MOD_OBJECT || h.filetype > MOD_LIBRARY) {
 		warnx("Invalid object file: %s", name.c_str());
-		close(fd);
 		return false;
 	}
 
 	if (h.filetype == MOD_LIBRARY) {
 		warnx("%s is a library", name.c_str());
-		close(fd);
 		// todo -- add to library list...
 		return true;
 	}
 
-	lseek(fd, 0, SEEK_SET);
-	while(one_module(name, fd)) ;
+	size_t offset = 0;
+	for(;;) {
+		module m;
+		if (!find_module(name, file, offset, m)) break;
+		modules.emplace_back(std::move(m));
+	}
 
-	close(fd);
 	return true;
 }
 
@@ -1384,6 +1854,31 @@ enum {
 };
 
 
+/*
+ * an open library.  dictionary lookups use the .idx file if it's
+ * current, otherwise the decoded dictionary.
+ */
+struct library {
+	std::string path;
+	mapped_file file;
+	Lib_head header;
+
+	lib_index index;
+	bool indexed = false;
+	std::unordered_map<uint32_t, uint32_t> symbols; // name id -> module offset
+
+	// map of which modules have been loaded or are pending processing.
+	std::map<uint32_t, int> modules;
+
+	optional<uint32_t> find(uint32_t name) const {
+		if (indexed) return index.find(strings.c_str(name), strings.length(name), strings.hash(name));
+		auto iter = symbols.find(name);
+		if (iter == symbols.end()) return optional<uint32_t>();
+		return optional<uint32_t>(iter->second);
+	}
+};
+
+
 /*
  * observation: the library symbol size will far exceed the missing symbols size.
  * Therefore, library symbols should be an unordered_map and explicitely look up
@@ -1392,17 +1887,17 @@ enum {
  * output c is a map (and thus sorted) to guarantee reproducable builds.
  * (could use a vector then sort/unique it...)
  */
-bool intersection(const std::unordered_map<std::string, uint32_t> &a,
-	const std::set<std::string> &b, 
+bool intersection(const library &a,
+	const std::set<uint32_t> &b, 
 	std::map<uint32_t, int> &c)
 {
 	bool rv = false;
 
 	for (const auto &name : b) {
-		auto iter = a.find(name);
-		if (iter == a.end()) continue;
+		auto offset = a.find(name);
+		if (!offset) continue;
 		rv = true;
-		c.emplace(iter->second, kPending);		
+		c.emplace(*offset, kPending);
 	}
 
 	return rv;
@@ -1440,31 +1935,28 @@ bool intersection(const std::map<std::string, uint32_t> &a,
 #endif
 
 
-bool one_lib(const std::string &path) {
+bool open_lib(const std::string &path, library &lib) {
 
-	Lib_head h;
+	Lib_head &h = lib.header;
+	mapped_file &file = lib.file;
 
-	int fd = open(path.c_str(), O_RDONLY | O_BINARY);
-	if (fd < 0) {
-		if (errno == ENOENT) return false;
-	}
+	bool ok = file.open(path);
+	if (!ok && errno == ENOENT) return false;
 
 	if (flags.v) printf("Processing library %s\n", path.c_str());
 
-	if (fd < 0) {
+	if (!ok) {
 		warn("Unable to open %s", path.c_str());
 		return false;
 	}
 
-	ssize_t ok;
-
-	ok = read(fd, &h, sizeof(h));
-	if (ok != sizeof(h)) {
+	if (file.size() < sizeof(h)) {
 		warnx("Invalid library file: %s", path.c_str());
-		close(fd);
 		return false;
 	}
 
+	memcpy(&h, file.data(), sizeof(h));
+
 	le_to_host(h.l_magic);
 	le_to_host(h.l_version);
 	le_to_host(h.l_filtyp);
@@ -1476,23 +1968,22 @@ bool one_lib(const std::string &path) {
 
 	if (h.l_magic != MOD_MAGIC || h.l_version != MOD_VERSION || h.l_filtyp != MOD_LIBRARY) {
 		warnx("Invalid library file: %s", path.c_str());
-		close(fd);
 		return false;
 	}
 
-	// read the symbol dictionary.
-
-	std::vector<uint8_t> data;
-	data.resize(h.l_modstart - sizeof(h));
-	ok = read(fd, data.data(), data.size());
-	if (ok != data.size()) {
+	// the symbol dictionary.
+	if (h.l_modstart < sizeof(h) || h.l_modstart > file.size()) {
 		warnx("Invalid library file: %s", path.c_str());
 		return false;
 	}
 
-	auto iter = data.begin();
-	auto end = data.end();
+	lib.path = path;
 
+	// use the .idx file if it's current, otherwise decode the dictionary.
+	lib.indexed = lib.index.open(path, file, h.l_modstart);
+	if (lib.indexed) return true;
+
+	auto iter = file.begin() + sizeof(h);
 
 	// files -- only reading since it's variable length.
 	for (unsigned i = 0; i < h.l_numfiles; ++i) {
@@ -1504,12 +1995,7 @@ bool one_lib(const std::string &path) {
 		//iter += size; // don't care about the name.
 	}
 
-	std::unordered_map<std::string, uint32_t> lib_symbol_map;
-
-
-	// map of which modules have been loaded or are pending processing.
-	std::map<uint32_t, int> modules;
-
+	std::vector< std::pair<std::string, uint32_t> > entries;
 
 	auto name_iter = iter + h.l_numsyms * 8;
 	for (unsigned i = 0; i < h.l_numsyms; ++i) {
@@ -1518,64 +2004,156 @@ bool one_lib(const std::string &path) {
 		uint32_t offset = read_32(iter) + h.l_modstart;
 
 		auto tmp = name_iter + name_offset;
-		std::string name = read_pstring(tmp);
+		uint32_t name = strings.intern((const char *)tmp + 1, *tmp);
 
-		lib_symbol_map.emplace(std::move(name), offset);
+		if (lib.symbols.emplace(name, offset).second && flags.i)
+			entries.emplace_back(strings.str(name), offset);
 
 		//modules[offset] = 0;
 	}
 
+	if (flags.i) {
+		if (flags.v) printf("Creating %s\n", lib_index::index_path(path).c_str());
+		lib_index::create(path, file, h.l_modstart, entries);
+	}
 
+	return true;
+}
 
+/*
+ * load all pending modules.  returns false if there weren't any.
+ */
+bool load_pending(library &lib, std::set<uint32_t> *local_undefined = nullptr) {
 
+	std::vector<module> pending;
 
-	// find an intersection of undefined symbols and symbols defined in lib_symbol_map
+	for (auto &x : lib.modules) {
+		uint32_t offset = x.first;
+		int status = x.second;
 
-	if (!intersection(lib_symbol_map, undefined_symbols, modules)) {
-		close(fd);
-		return true;
+		if (status == kPending) {
+			x.second = kProcessed;
+			size_t tmp = offset;
+			module m;
+			if (find_module(lib.path, lib.file, tmp, m))
+				pending.emplace_back(std::move(m));
+		}
 	}
+	if (pending.empty()) return false;
+
+	load_modules(pending, local_undefined);
+	return true;
+}
+
+/*
+ * wdcln search order: each library is only searched once, so a symbol
+ * referenced from a later library can't be resolved by an earlier one.
+ */
+void strict_lib(library &lib) {
+
+	// find an intersection of undefined symbols and symbols defined in the library
+
+	if (!intersection(lib, undefined_symbols, lib.modules)) return;
 
 	for(;;) {
-		bool delta = false;
+		std::set<uint32_t> local_undefined_symbols;
+
+		if (!load_pending(lib, &local_undefined_symbols)) break;
+
+		if (!intersection(lib, local_undefined_symbols, lib.modules)) break;
+	}
+}
+
+/*
+ * resolve against all libraries at once.  each undefined symbol is resolved
+ * by the first library (in -l order) that defines it, regardless of which
+ * library (or object file) referenced it, and libraries are revisited until
+ * nothing new is loaded.
+ *
+ * each name is looked up once and queued for the library that defines it
+ * first.  modules are loaded a library at a time (in order) so the results
+ * match strict mode whenever strict mode would succeed.
+ */
+void global_libs(std::vector< std::unique_ptr<library> > &libs) {
+
+	// name -> (library, module offset) of the first definition.
+	// names no library defines map to libs.size().
+	std::unordered_map<uint32_t, std::pair<unsigned, uint32_t>> first;
+	std::vector< std::set<uint32_t> > queued(libs.size());
+
+	auto enqueue = [&](const std::set<uint32_t> &names) {
+		for (const auto &name : names) {
+			auto iter = first.find(name);
+			if (iter == first.end()) {
+				std::pair<unsigned, uint32_t> def(libs.size(), 0);
+				for (unsigned i = 0; i < libs.size(); ++i) {
+					auto offset = libs[i]->find(name);
+					if (!offset) continue;
+					def = std::make_pair(i, *offset);
+					break;
+				}
+				iter = first.emplace(name, def).first;
+			}
+			if (iter->second.first < libs.size())
+				queued[iter->second.first].emplace(name);
+		}
+	};
+
+	enqueue(undefined_symbols);
 
-		std::set<std::string> local_undefined_symbols;
+	bool more = true;
+	while (more) {
+		more = false;
 
+		for (unsigned i = 0; i < libs.size(); ++i) {
+			library &lib = *libs[i];
 
-		for (auto &x : modules) {
-			uint32_t offset = x.first;
-			int status = x.second;
+			while (!queued[i].empty()) {
+				std::set<uint32_t> names;
+				names.swap(queued[i]);
 
-			if (status == kPending) {
-				x.second = kProcessed;
-				lseek(fd, offset, SEEK_SET);
-				one_module(path, fd, &local_undefined_symbols);
-				delta = true;
+				// skip anything defined since it was queued.
+				for (const auto &name : names) {
+					if (undefined_symbols.count(name))
+						lib.modules.emplace(first[name].second, kPending);
+				}
+
+				std::set<uint32_t> referenced;
+				if (load_pending(lib, &referenced)) enqueue(referenced);
 			}
+			if (undefined_symbols.empty()) return;
 		}
-		if (!delta) break;
 
-		delta = intersection(lib_symbol_map, local_undefined_symbols, modules);
-		if (!delta) break;
+		for (const auto &q : queued) {
+			if (!q.empty()) more = true;
+		}
 	}
-
-	close(fd);
-	return true;
 }
 
 void libraries() {
 
 	if (undefined_symbols.empty()) return;
 
+	STATS_TIMER(LIBRARIES);
+
+	std::vector< std::unique_ptr<library> > libs;
+
 	for (auto &l : flags.l) {
 		for (auto &L : flags.L) {
 			//std::string path = L + "lib" + l;
 			std::string path = L + l + ".lib";
 
-			if (one_lib(path)) break;
+			std::unique_ptr<library> lib(new library);
+			if (!open_lib(path, *lib)) continue;
+
+			if (flags.s) strict_lib(*lib);
+			else libs.emplace_back(std::move(lib));
+			break;
 		}
-		if (undefined_symbols.empty()) break;
+		if (flags.s && undefined_symbols.empty()) break;
 	}
+
+	if (!flags.s) global_libs(libs);
 }
 
 #if 0
@@ -1657,12 +2235,20 @@ void usage(int rv) {
 		" -v               be verbose\n"
 		" -X               inhibit ExpressLoad segment\n"
 		" -C               inhibit SUPER records\n"
+		" -Z               inhibit DS records for zero-filled data (only used with -X or -1)\n"
 		" -S               add stack segment\n"
+		" -P               pack code sections into as few segments as possible\n"
+		" -H b|i|m         flat binary, Intel HEX or Motorola S-record output\n"
+		" -A section=addr  place section at addr (hex, with -H)\n"
+		" -j n             parse input modules and encode segments with n threads\n"
 		" -1               generate version 1 OMF File\n"
-		" -o file          specify outfile name\n"
+		" -o file          specify outfile name (- for stdout)\n"
 		" -l library       specify library\n"
 		" -L path          specify library path\n"
-		" -t xx[:xxxx]     specify file type\n",
+		" -i               create/update library index (.idx) files\n"
+		" -s               strict library search order (wdcln compatible)\n"
+		" -t xx[:xxxx]     specify file type\n"
+		" --stats[=json]   report per-phase timing and counters\n",
 		stdout
 	);
 	exit(rv);
@@ -1671,20 +2257,66 @@ void usage(int rv) {
 int main(int argc, char **argv) {
 
 
+	static struct option long_options[] = {
+		{ "stats", optional_argument, nullptr, 256 },
+		{ nullptr, 0, nullptr, 0 }
+	};
+
 	int c;
-	while ((c = getopt(argc, argv, "vCXSL:l:o:t:")) != -1) {
+	while ((c = getopt_long(argc, argv, "vCXZSPisj:L:l:o:t:H:A:", long_options, nullptr)) != -1) {
 		switch(c) {
 			case 'h': usage(0); break;
 
 			case 'v': flags.v = true; break;
 			case 'S': flags.S = true; break;
+			case 'i': flags.i = true; break;
+			case 's': flags.s = true; break;
+			case 'P': flags.P = true; break;
 
 			case '1': flags.omf_flags |= OMF_V1; break;
 			case 'X': flags.omf_flags |= OMF_NO_EXPRESS; break;
 			case 'C': flags.omf_flags |= OMF_NO_SUPER; break;
+			case 'Z': flags.omf_flags |= OMF_NO_DS; break;
 
 			case 'o': flags.o = optarg; break;
 
+			case 'H': {
+				// -H b|i|m -- like wdcln -HB, -HI, -HM
+				std::string tmp(optarg);
+				if (tmp.length() != 1) errx(EX_USAGE, "Invalid -H argument: %s", optarg);
+				switch(tolower(tmp[0])) {
+					case 'b': flags.bin_format = BIN_FLAT; break;
+					case 'i': flags.bin_format = BIN_INTEL_HEX; break;
+					case 'm': case 's': flags.bin_format = BIN_SREC; break;
+					default: errx(EX_USAGE, "Invalid -H argument: %s", optarg);
+				}
+				flags.H = true;
+				break;
+			}
+
+			case 'A': {
+				// -A section=addr
+				const char *cp = strchr(optarg, '=');
+				if (!cp || cp == optarg) errx(EX_USAGE, "Invalid -A argument: %s", optarg);
+				const char *hex = cp + 1;
+				if (*hex == '$') ++hex;
+				else if (hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) hex += 2;
+				char *end;
+				unsigned long n = strtoul(hex, &end, 16);
+				if (*end || end == hex || n > 0xffffff) errx(EX_USAGE, "Invalid -A argument: %s", optarg);
+				flags.A.emplace_back(std::string((const char *)optarg, cp), n);
+				break;
+			}
+
+			case 'j': {
+				char *end;
+				unsigned long n = strtoul(optarg, &end, 10);
+				if (*end || end == optarg) errx(EX_USAGE, "Invalid -j argument: %s", optarg);
+				if (n == 0) n = std::thread::hardware_concurrency();
+				flags.j = std::max(1ul, std::min(n, 64ul));
+				break;
+			}
+
 			case 'l': {
 				if (*optarg) flags.l.emplace_back(optarg);
 				break;
@@ -1696,6 +2328,15 @@ int main(int argc, char **argv) {
 				flags.L.emplace_back(std::move(tmp));
 				break;
 			}
+			case 256: {
+				// --stats[=json]
+				if (optarg && strcmp(optarg, "json")) errx(EX_USAGE, "Invalid --stats argument: %s", optarg);
+				if (!stats::enabled) warnx("--stats: statistics were not compiled in");
+				flags.stats = true;
+				flags.stats_json = optarg != nullptr;
+				break;
+			}
+
 			case 't': {
 				// -t xx[:xxxx] -- set file/auxtype.
 				if (!parse_ft(optarg)) {
@@ -1718,17 +2359,36 @@ int main(int argc, char **argv) {
 
 	if (argc == 0) usage(EX_USAGE);
 
+	if (!flags.A.empty() && !flags.H) errx(EX_USAGE, "-A requires -H");
+
+	// verbose output goes to stdout.
+	if (flags.v && flags.o == "-") errx(EX_USAGE, "-v can't be used with -o -");
+
 	init();
 
-	for (int i = 0 ; i < argc; ++i) {
-		if (!one_file(argv[i])) flags.errors++;
+	{
+		STATS_TIMER(PARSE);
+
+		// with -j, all modules are parsed concurrently then merged in order.
+		std::vector<mapped_file> files(argc);
+		std::vector<module> modules;
+
+		for (int i = 0 ; i < argc; ++i) {
+			if (!one_file(argv[i], files[i], modules)) flags.errors++;
+			if (flags.j == 1) {
+				load_modules(modules);
+				modules.clear();
+				files[i].close();
+			}
+		}
+		load_modules(modules);
 	}
 
 
 	if (flags.v && !undefined_symbols.empty()) {
 		printf("Undefined Symbols:\n");
-		for (const auto & s : undefined_symbols) {
-			printf("%s\n", s.c_str());
+		for (auto s : sorted_names(undefined_symbols)) {
+			printf("%s\n", strings.c_str(s));
 		}
 		printf("\n");
 	}
@@ -1739,7 +2399,7 @@ int main(int argc, char **argv) {
 	if (!undefined_symbols.empty()) {
 
 		fprintf(stderr, "Unable to resolve the following symbols:\n");
-		for (auto &s : undefined_symbols) fprintf(stderr, "%s\n", s.c_str());
+		for (auto s : sorted_names(undefined_symbols)) fprintf(stderr, "%s\n", strings.c_str(s));
 
 		exit(EX_DATAERR);
 	}
@@ -1752,12 +2412,25 @@ int main(int argc, char **argv) {
 		for (const auto &s : sections) {
 			//if (s.flags & SEC_REF_ONLY) continue;
 			printf("section %3d %-20s $%04x $%04x\n",
-				s.number, s.name.c_str(), (uint32_t)s.data.size(), s.size);
+				s.number, strings.c_str(s.name), (uint32_t)s.data.size(), s.size);
 		}
 		fputs("\n", stdout);
 	}
 
-	build_omf_segments();
+	if (flags.H) {
+		build_bin_segments();
+	} else {
+		build_omf_segments();
+		renumber_segments();
+	}
+
+#ifndef NO_STATS
+	STATS_SET(SYMBOLS, symbols.size());
+	for (const auto &s : omf_segments) {
+		STATS_ADD(RELOCS, s.relocs.size());
+		STATS_ADD(INTERSEGS, s.intersegs.size());
+	}
+#endif
 
 	if (flags.v) {
 		for (const auto &s : omf_segments) {
@@ -1775,6 +2448,21 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if (flags.H) {
+		static const char *names[] = { "out.bin", "out.hex", "out.s28" };
+		if (flags.o.empty()) flags.o = names[flags.bin_format];
+		if (!flags.file_type) {
+			// BIN with the load address or TXT.
+			flags.file_type = flags.bin_format == BIN_FLAT ? 0x06 : 0x04;
+			if (flags.bin_format == BIN_FLAT) {
+				flags.aux_type = 0xffffff;
+				for (const auto &s : omf_segments)
+					if (!s.data.empty()) flags.aux_type = std::min(flags.aux_type, s.org);
+				if (flags.aux_type > 0xffff) flags.aux_type = 0;
+			}
+		}
+	}
+
 	if (flags.o.empty()) flags.o = "out.omf";
 	if (!flags.file_type) {
 		flags.file_type = 0xb3;
@@ -1782,7 +2470,12 @@ int main(int argc, char **argv) {
 
 	int set_file_type(const std::string &path, uint16_t file_type, uint32_t aux_type);
 
-	save_omf(flags.o, omf_segments, flags.omf_flags);
-	set_file_type(flags.o, flags.file_type, flags.aux_type);
+	if (flags.v) flags.omf_flags |= OMF_VERBOSE;
+	// an unchanged file keeps its mtime; set_file_type() won't rewrite matching metadata.
+	if (flags.H) save_bin(flags.o, omf_segments, flags.bin_format, flags.omf_flags);
+	else save_omf(flags.o, omf_segments, flags.omf_flags, flags.j);
+	if (flags.o != "-") set_file_type(flags.o, flags.file_type, flags.aux_type);
+
+	if (flags.stats && stats::enabled) stats::report(flags.o == "-" ? stderr : stdout, flags.stats_json);
 }
 
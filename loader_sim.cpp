@@ -0,0 +1,193 @@
+#include "loader_sim.h"
+#include "omf_reader.h"
+
+#include <err.h>
+
+#include <algorithm>
+
+namespace {
+
+	/*
+	 * estimated 65816 cycles.  these are ballpark figures for the loader's
+	 * inner loops, good enough to compare one link against another.
+	 */
+	enum {
+		kSegmentHeader = 600, // read and validate a segment header and names
+		kExpressHeader = 150, // ... or take it from the ExpressLoad table
+		kRecord = 40, // fetch an opcode and dispatch
+		kCopyByte = 7, // mvn
+		kZeroByte = 3,
+		kReloc = 110, // RELOC, cRELOC
+		kInterseg = 190, // INTERSEG, cINTERSEG (segment lookup)
+		kSuperRecord = 80,
+		kSuperEntry = 45, // SUPER relocations share the decode
+		kLoadAddress = 16, // add in the load address for each patch
+	};
+
+	uint32_t bank_align(uint32_t address, uint32_t length) {
+		// don't let a segment that fits in a bank cross into the next one.
+		if (length <= 0x10000 && (address & 0xffff) + length > 0x10000)
+			return (address + 0xffff) & ~0xffff;
+		return address;
+	}
+}
+
+load_stats &load_stats::operator+=(const load_stats &o) {
+	segments += o.segments;
+	records += o.records;
+	relocations += o.relocations;
+	super_entries += o.super_entries;
+	bytes_read += o.bytes_read;
+	bytes_copied += o.bytes_copied;
+	bytes_zeroed += o.bytes_zeroed;
+	cycles += o.cycles;
+	unresolved += o.unresolved;
+	return *this;
+}
+
+
+bool simulate_load(const std::string &path, std::vector<loaded_segment> &segments, load_stats &total, bool by_name) {
+
+	omf_reader reader;
+	if (!reader.open(path)) return false;
+
+	segments.clear();
+	total = load_stats();
+
+	std::vector< std::pair<omf::segment, omf_reader::header> > file;
+	{
+		omf::segment seg;
+		omf_reader::header h;
+		while (reader.next(seg, h)) {
+			if (omf_reader::is_express(seg)) {
+				// read and parse the table.
+				total.bytes_read += h.bytecount;
+				total.records += h.records;
+				total.cycles += kSegmentHeader + h.records * kRecord;
+				continue;
+			}
+			file.emplace_back(std::move(seg), h);
+		}
+	}
+
+	const auto &express = reader.express();
+
+	for (const auto &x : file) {
+		const auto &seg = x.first;
+
+		loaded_segment ls;
+		ls.segnum = seg.segnum;
+		ls.kind = seg.kind;
+		ls.segname = seg.segname;
+
+		ls.memory = seg.data;
+		ls.memory.resize(seg.data.size() + seg.reserved_space, 0);
+		segments.emplace_back(std::move(ls));
+	}
+
+	// place the segments, in file order or by name.
+	std::vector<size_t> order(file.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+	if (by_name) {
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+			const auto &sa = segments[a];
+			const auto &sb = segments[b];
+			if (sa.segname != sb.segname) return sa.segname < sb.segname;
+			return sa.kind < sb.kind;
+		});
+	}
+
+	uint32_t address = 0x020000;
+	for (size_t i : order) {
+		const auto &seg = file[i].first;
+		const auto &h = file[i].second;
+		auto &ls = segments[i];
+
+		if (seg.org) {
+			ls.address = seg.org;
+		} else {
+			uint32_t align = seg.alignment;
+			if (align > 1 && !(align & (align - 1)))
+				address = (address + align - 1) & ~(align - 1);
+			if (h.banksize) address = bank_align(address, h.length);
+			ls.address = address;
+			address += std::max(h.length, (uint32_t)1);
+		}
+	}
+
+	auto base = [&](unsigned segnum, bool &ok) -> uint32_t {
+		for (const auto &s : segments)
+			if (s.segnum == segnum) { ok = true; return s.address; }
+		ok = false;
+		return 0;
+	};
+
+	auto patch = [](std::vector<uint8_t> &memory, uint32_t offset, unsigned size, uint32_t value, uint8_t shift) {
+		int8_t n = shift;
+		if (n < 0) value >>= -n;
+		else value <<= n;
+		for (unsigned i = 0; i < size && offset + i < memory.size(); ++i, value >>= 8)
+			memory[offset + i] = value;
+	};
+
+	for (size_t i = 0; i < file.size(); ++i) {
+		const auto &seg = file[i].first;
+		const auto &h = file[i].second;
+		auto &ls = segments[i];
+		auto &st = ls.stats;
+
+		st.segments = 1;
+
+		// ExpressLoad: the header comes from the table, the lconst is read
+		// straight into the segment and only the relocation dictionary is parsed.
+		auto e = std::find_if(express.begin(), express.end(), [&](const omf_reader::express_entry &e){
+			return e.segnum == seg.segnum;
+		});
+		ls.express = e != express.end() && h.express_ok &&
+			e->lconst_mark == h.lconst_mark && e->lconst_size == h.lconst_size &&
+			e->reloc_mark == h.reloc_mark && e->reloc_size == h.reloc_size;
+
+		if (e != express.end() && !ls.express)
+			warnx("%s: segment %u: ExpressLoad entry doesn't match the segment", path.c_str(), seg.segnum);
+
+		uint64_t relocs = h.reloc_records + h.interseg_records + h.super_records;
+		if (ls.express) {
+			st.bytes_read = h.lconst_size + h.reloc_size;
+			st.records = relocs + 1; // end
+			st.cycles = kExpressHeader + st.records * kRecord;
+		} else {
+			st.bytes_read = h.bytecount;
+			st.records = h.records;
+			st.bytes_copied = h.const_bytes;
+			st.cycles = kSegmentHeader + st.records * kRecord + h.const_bytes * kCopyByte;
+		}
+
+		st.bytes_zeroed = h.ds_bytes + seg.reserved_space;
+		st.cycles += st.bytes_zeroed * kZeroByte;
+
+		st.super_entries = h.super_entries;
+		st.cycles += h.reloc_records * kReloc + h.interseg_records * kInterseg;
+		st.cycles += h.super_records * kSuperRecord + h.super_entries * kSuperEntry;
+
+		for (const auto &r : seg.relocs) {
+			patch(ls.memory, r.offset, r.size, r.value + ls.address, r.shift);
+			st.relocations++;
+		}
+
+		for (const auto &r : seg.intersegs) {
+			bool ok = false;
+			uint32_t address = r.file == 1 ? base(r.segment, ok) : 0;
+			if (!ok) {
+				st.unresolved++;
+				continue;
+			}
+			patch(ls.memory, r.offset, r.size, r.segment_offset + address, r.shift);
+			st.relocations++;
+		}
+		st.cycles += st.relocations * kLoadAddress;
+
+		total += st;
+	}
+
+	return true;
+}
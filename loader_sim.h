@@ -0,0 +1,47 @@
+#ifndef __loader_sim_h__
+#define __loader_sim_h__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * host-side model of the IIgs System Loader.
+ *
+ * Loads an OMF file the way the loader would (using the ExpressLoad table
+ * when it's valid), applies every relocation to the loaded segments and
+ * counts the work involved. cycles is a rough estimate of the loader's own
+ * CPU time (record dispatch, copying, zeroing, patching); disk time is
+ * left out, see bytes_read.
+ */
+
+struct load_stats {
+	unsigned segments = 0;
+	uint64_t records = 0; // records parsed
+	uint64_t relocations = 0; // locations patched, any encoding
+	uint64_t super_entries = 0; // ... of which came from SUPER records
+	uint64_t bytes_read = 0;
+	uint64_t bytes_copied = 0; // moved from the read buffer into the segment
+	uint64_t bytes_zeroed = 0; // DS, reserved space
+	uint64_t cycles = 0;
+	unsigned unresolved = 0; // intersegs to other files or missing segments
+
+	load_stats &operator+=(const load_stats &);
+};
+
+struct loaded_segment {
+	uint16_t segnum = 0;
+	uint16_t kind = 0;
+	std::string segname;
+	uint32_t address = 0;
+	bool express = false; // loaded via ExpressLoad
+	std::vector<uint8_t> memory; // after relocation
+	load_stats stats;
+};
+
+// returns false (and sets errno) if path can't be opened. malformed files are fatal.
+// segments are placed in file order, or in name order if by_name (so the loaded
+// images don't depend on how the segments were numbered).
+bool simulate_load(const std::string &path, std::vector<loaded_segment> &segments, load_stats &total, bool by_name = false);
+
+#endif
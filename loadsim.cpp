@@ -0,0 +1,118 @@
+#include <string>
+#include <err.h>
+#include <unistd.h>
+#include <sysexits.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "loader_sim.h"
+
+
+struct {
+	bool v = false;
+	bool n = false;
+} flags;
+
+
+void usage(int rv) {
+	fputs(
+		"wdcloadsim [flags] file ...\n\n"
+		"Flags:\n"
+		" -h               show usage\n"
+		" -v               show each segment\n"
+		" -n               place segments in name order\n",
+		stdout
+	);
+	exit(rv);
+}
+
+
+// FNV-1a, to compare loaded images between links.
+uint32_t checksum(const std::vector<uint8_t> &data) {
+	uint32_t h = 0x811c9dc5;
+	for (auto x : data) {
+		h ^= x;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+
+void print_segment(const loaded_segment &s) {
+	const auto &st = s.stats;
+	printf("  %3u %-20s $%06x $%06x %c %6llu %6llu %8llu %10llu  %08x\n",
+		s.segnum, s.segname.c_str(), s.address, (uint32_t)s.memory.size(),
+		s.express ? 'X' : ' ',
+		(unsigned long long)st.records,
+		(unsigned long long)st.relocations,
+		(unsigned long long)st.bytes_read,
+		(unsigned long long)st.cycles,
+		checksum(s.memory)
+	);
+}
+
+
+int simulate(const std::string &path) {
+
+	std::vector<loaded_segment> segments;
+	load_stats total;
+
+	if (!simulate_load(path, segments, total, flags.n)) {
+		warn("Unable to open %s", path.c_str());
+		return 1;
+	}
+
+	unsigned express = 0;
+	for (const auto &s : segments) express += s.express;
+
+	printf("%s\n", path.c_str());
+
+	if (flags.v) {
+		printf("  seg name                 address length    records relocs     read     cycles  checksum\n");
+		for (const auto &s : segments) print_segment(s);
+	}
+
+	printf("  segments        %u (%u ExpressLoad)\n", total.segments, express);
+	printf("  records         %llu\n", (unsigned long long)total.records);
+	printf("  relocations     %llu (%llu super)\n",
+		(unsigned long long)total.relocations, (unsigned long long)total.super_entries);
+	printf("  bytes read      %llu\n", (unsigned long long)total.bytes_read);
+	printf("  bytes copied    %llu\n", (unsigned long long)total.bytes_copied);
+	printf("  bytes zeroed    %llu\n", (unsigned long long)total.bytes_zeroed);
+	printf("  cycles          %llu (%.3fs at 2.8MHz)\n",
+		(unsigned long long)total.cycles, total.cycles / 2.8e6);
+
+	if (total.unresolved)
+		warnx("%s: %u unresolved interseg references", path.c_str(), total.unresolved);
+
+	return 0;
+}
+
+
+int main(int argc, char **argv) {
+
+	int c;
+	while ((c = getopt(argc, argv, "hvn")) != -1) {
+		switch(c) {
+			case 'h': usage(0); break;
+			case 'v': flags.v = true; break;
+			case 'n': flags.n = true; break;
+			default: usage(EX_USAGE); break;
+		}
+	}
+
+	argv += optind;
+	argc -= optind;
+
+	if (argc == 0) usage(EX_USAGE);
+
+	int rv = 0;
+	for (int i = 0; i < argc; ++i) {
+		rv |= simulate(argv[i]);
+		if (i + 1 < argc) printf("\n");
+	}
+
+	return rv ? EX_NOINPUT : 0;
+}
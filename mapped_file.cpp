@@ -0,0 +1,91 @@
+#include "mapped_file.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+mapped_file::~mapped_file() {
+	close();
+}
+
+void mapped_file::close() {
+#ifndef _WIN32
+	if (_mapped) munmap(const_cast<uint8_t *>(_data), _size);
+#endif
+	_data = nullptr;
+	_size = 0;
+	_mapped = false;
+	_buffer.clear();
+}
+
+bool mapped_file::open(const std::string &path) {
+
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_BINARY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int e = errno;
+		::close(fd);
+		errno = e;
+		return false;
+	}
+
+#ifndef _WIN32
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *vp = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (vp != MAP_FAILED) {
+			::close(fd);
+			_data = (const uint8_t *)vp;
+			_size = st.st_size;
+			_mapped = true;
+			return true;
+		}
+		// fall through and read it.
+	}
+#endif
+
+	if (S_ISREG(st.st_mode)) _buffer.reserve(st.st_size);
+	bool ok = read_all(fd);
+	int e = errno;
+	::close(fd);
+	errno = e;
+	return ok;
+}
+
+bool mapped_file::read_all(int fd) {
+
+	for(;;) {
+		size_t size = _buffer.size();
+		size_t chunk = std::max((size_t)4096, _buffer.capacity() - size);
+		_buffer.resize(size + chunk);
+
+		ssize_t ok = read(fd, _buffer.data() + size, chunk);
+		if (ok < 0) {
+			if (errno == EINTR) { _buffer.resize(size); continue; }
+			_buffer.clear();
+			return false;
+		}
+		_buffer.resize(size + ok);
+		if (ok == 0) break;
+	}
+
+	_data = _buffer.data();
+	_size = _buffer.size();
+	return true;
+}
@@ -0,0 +1,45 @@
+#ifndef __mapped_file_h__
+#define __mapped_file_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * read-only view of an entire input file.
+ * regular files are mmapped; pipes and anything else that can't be
+ * mapped are read into memory instead.
+ */
+class mapped_file {
+
+public:
+
+	mapped_file() = default;
+	mapped_file(const mapped_file &) = delete;
+	mapped_file &operator=(const mapped_file &) = delete;
+	~mapped_file();
+
+	// returns false (and sets errno) on failure.
+	bool open(const std::string &path);
+	void close();
+
+	const uint8_t *data() const { return _data; }
+	size_t size() const { return _size; }
+
+	const uint8_t *begin() const { return _data; }
+	const uint8_t *end() const { return _data + _size; }
+
+	bool mapped() const { return _mapped; }
+
+private:
+
+	bool read_all(int fd);
+
+	const uint8_t *_data = nullptr;
+	size_t _size = 0;
+	bool _mapped = false;
+	std::vector<uint8_t> _buffer;
+};
+
+#endif
@@ -8,15 +8,22 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <err.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
 #include <sysexits.h>
 #include <assert.h>
 
-#include "optional.h"
-
-#ifndef O_BINARY
-#define O_BINARY 0
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <limits.h>
 #endif
 
+#include "stats.h"
+#include "parallel.h"
+#include "mapped_file.h"
+#include "replace_file.h"
+
 enum class endian {
 #ifdef _WIN32
     little = 0,
@@ -239,12 +246,23 @@ public:
 		_count = 0;
 	}
 
-	const std::vector<uint8_t> &data() {
+	const std::vector<uint8_t> &data() const {
 		return _data;
 	}
 
 };
 
+// relocation dictionary size, by record type.
+struct reloc_sizes {
+	uint32_t reloc = 0;
+	uint32_t creloc = 0;
+	uint32_t interseg = 0;
+	uint32_t cinterseg = 0;
+	uint32_t super = 0;
+	unsigned super_records = 0;
+
+	uint32_t total() const { return reloc + creloc + interseg + cinterseg + super; }
+};
 
 enum {
 	SUPER_RELOC2,
@@ -287,197 +305,364 @@ enum {
 	SUPER_INTERSEG36,
 };
 
-uint32_t add_relocs(std::vector<uint8_t> &data, size_t data_offset, omf::segment &seg, bool compress, bool super) {
-
-	std::array< optional<super_helper>, 38 > ss;
+namespace {
 
+	// the SUPER record type that can hold a relocation, or -1.
 
-	uint32_t reloc_size = 0;
-
-	for (auto &r : seg.relocs) {
+	int super_type(const omf::reloc &r, unsigned segnum) {
+		if (r.shift == 0 && r.size == 2) return SUPER_RELOC2;
+		if (r.shift == 0 && r.size == 3) return SUPER_RELOC3;
+		// if size == 2 && shift == -16, -> SUPER INTERSEG 
+		if (segnum <= 12 && r.shift == 0xf0 && r.size == 2) return SUPER_INTERSEG24 + segnum;
+		return -1;
+	}
 
-		if (compress && r.can_compress()) {
+	int super_type(const omf::interseg &r) {
+		if (r.shift == 0 && r.size == 3) return SUPER_INTERSEG1;
+		if (r.shift == 0 && r.size == 2 && r.segment <= 12) return SUPER_INTERSEG12 + r.segment;
+		if (r.shift == 0xf0 && r.size == 2 && r.segment <= 12) return SUPER_INTERSEG24 + r.segment;
+		return -1;
+	}
 
-			if (super) {
-				if (r.shift == 0 && r.size == 2) {
-					constexpr int n = SUPER_RELOC2;
+	// store the value for a SUPER relocation in the segment data.
+	void super_value(uint8_t *data, const omf::reloc &r, int type) {
+		unsigned size = type == SUPER_RELOC3 ? 3 : 2;
+		uint32_t value = r.value;
+		for (unsigned i = 0; i < size; ++i, value >>= 8)
+			data[r.offset + i] = value;
+	}
 
-					auto &sr = ss[n];
-					if (!sr) sr.emplace();
-					sr->append(r.offset);
+	void super_value(uint8_t *data, const omf::interseg &r, int type) {
+		uint32_t value = r.segment_offset;
+		data[r.offset + 0] = value; value >>= 8;
+		data[r.offset + 1] = value; value >>= 8;
+		if (type == SUPER_INTERSEG1) data[r.offset + 2] = r.segment;
+	}
+}
 
-					uint32_t value = r.value;
-					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
-					continue;
+/*
+ * append the relocation records for seg to records.  values covered by
+ * SUPER records are stored into data (the segment's data) in place.
+ *
+ * relocations are sorted by offset. each SUPER type is only used if it's
+ * smaller than the cRELOC/cINTERSEG records it replaces (a SUPER record has
+ * 6 bytes of overhead, so a handful of relocations aren't worth it).
+ */
+uint32_t add_relocs(std::vector<uint8_t> &records, uint8_t *data, omf::segment &seg, bool compress, bool super, reloc_sizes &sizes) {
+
+	auto by_offset = [](const auto &a, const auto &b){ return a.offset < b.offset; };
+	std::stable_sort(seg.relocs.begin(), seg.relocs.end(), by_offset);
+	std::stable_sort(seg.intersegs.begin(), seg.intersegs.end(), by_offset);
+
+	std::vector<int8_t> rtypes(seg.relocs.size(), -1);
+	std::vector<int8_t> itypes(seg.intersegs.size(), -1);
+
+	std::array< super_helper, 38 > ss;
+	std::array< uint32_t, 38 > plain{}; // size as individual records.
+	std::array< bool, 38 > use{};
+
+	if (compress && super) {
+		// relocs and intersegs may share a type so merge them in offset order.
+		size_t i = 0, j = 0;
+		while (i < seg.relocs.size() || j < seg.intersegs.size()) {
+			if (j == seg.intersegs.size() || (i < seg.relocs.size() && seg.relocs[i].offset <= seg.intersegs[j].offset)) {
+				const auto &r = seg.relocs[i];
+				int n = r.can_compress() ? super_type(r, seg.segnum) : -1;
+				if (n >= 0) {
+					ss[n].append(r.offset);
+					plain[n] += 7;
 				}
-
-				// sreloc 3 is for 3 bytes.  however 4 bytes is also ok since 
-				// it's 24-bit address space.
-				if (r.shift == 0 && (r.size == 2 || r.size == 3))
-				{
-					constexpr int n = SUPER_RELOC3;
-
-					auto &sr = ss[n];
-					if (!sr) sr.emplace();
-					sr->append(r.offset);
-
-					uint32_t value = r.value;
-					for (int i = 0; i < 3; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
-					continue;	
+				rtypes[i++] = n;
+			} else {
+				const auto &r = seg.intersegs[j];
+				int n = r.can_compress() ? super_type(r) : -1;
+				if (n >= 0) {
+					ss[n].append(r.offset);
+					plain[n] += 8;
 				}
+				itypes[j++] = n;
+			}
+		}
+		for (int n = 0; n < ss.size(); ++n) {
+			auto size = ss[n].data().size();
+			use[n] = size && size + 6 <= plain[n];
+		}
+	}
 
-				// if size == 2 && shift == -16, -> SUPER INTERSEG 
-				if (seg.segnum <= 12 && r.shift == 0xf0 && r.size == 2) {
+	for (size_t i = 0; i < seg.relocs.size(); ++i) {
+		const auto &r = seg.relocs[i];
+		int n = rtypes[i];
+		if (n >= 0 && use[n]) {
+			super_value(data, r, n);
+			continue;
+		}
 
-					int n = SUPER_INTERSEG24 + seg.segnum;
-					auto &sr = ss[n];
-					if (!sr) sr.emplace();
-					sr->append(r.offset);
+		if (compress && r.can_compress()) {
+			push(records, (uint8_t)omf::cRELOC);
+			push(records, (uint8_t)r.size);
+			push(records, (uint8_t)r.shift);
+			push(records, (uint16_t)r.offset);
+			push(records, (uint16_t)r.value);
+			sizes.creloc += 7;
+		} else {
+			push(records, (uint8_t)omf::RELOC);
+			push(records, (uint8_t)r.size);
+			push(records, (uint8_t)r.shift);
+			push(records, (uint32_t)r.offset);
+			push(records, (uint32_t)r.value);
+			sizes.reloc += 11;
+		}
+	}
 
-					uint32_t value = r.value;
-					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
-					continue;
-				}
-			}
+	for (size_t i = 0; i < seg.intersegs.size(); ++i) {
+		const auto &r = seg.intersegs[i];
+		int n = itypes[i];
+		if (n >= 0 && use[n]) {
+			super_value(data, r, n);
+			continue;
+		}
 
-			push(data, (uint8_t)omf::cRELOC);
-			push(data, (uint8_t)r.size);
-			push(data, (uint8_t)r.shift);
-			push(data, (uint16_t)r.offset);
-			push(data, (uint16_t)r.value);
-			reloc_size += 7;
+		if (compress && r.can_compress()) {
+			push(records, (uint8_t)omf::cINTERSEG);
+			push(records, (uint8_t)r.size);
+			push(records, (uint8_t)r.shift);
+			push(records, (uint16_t)r.offset);
+			push(records, (uint8_t)r.segment);
+			push(records, (uint16_t)r.segment_offset);
+			sizes.cinterseg += 8;
 		} else {
-			push(data, (uint8_t)omf::RELOC);
-			push(data, (uint8_t)r.size);
-			push(data, (uint8_t)r.shift);
-			push(data, (uint32_t)r.offset);
-			push(data, (uint32_t)r.value);
-			reloc_size += 11;
+			push(records, (uint8_t)omf::INTERSEG);
+			push(records, (uint8_t)r.size);
+			push(records, (uint8_t)r.shift);
+			push(records, (uint32_t)r.offset);
+			push(records, (uint16_t)r.file);
+			push(records, (uint16_t)r.segment);
+			push(records, (uint32_t)r.segment_offset);
+			sizes.interseg += 15;
 		}
 	}
 
-	for (const auto &r : seg.intersegs) {
-		if (compress && r.can_compress()) {
 
-			if (super) {
+	for (int i = 0; i < ss.size(); ++i) {
+		if (!use[i]) continue;
 
-				if (r.shift == 0 && r.size == 3) {
-					constexpr int n = SUPER_INTERSEG1;
-					auto &sr = ss[n];
-					if (!sr) sr.emplace();
-					sr->append(r.offset);
+		const auto &tmp = ss[i].data();
 
-					uint32_t value = r.segment_offset;
+		sizes.super += tmp.size() + 6;
+		sizes.super_records++;
+		STATS_ADD(SUPER_RECORDS, 1);
+		records.push_back(omf::SUPER);
+		push(records, ((uint32_t)tmp.size() + 1));
+		records.push_back(i);
 
-					data[data_offset + r.offset + 0] = value; value >>= 8;
-					data[data_offset + r.offset + 1] = value; value >>= 8;
-					data[data_offset + r.offset + 2] = r.segment;
-					continue;
-				}
+		records.insert(records.end(), tmp.begin(), tmp.end());
+	}
 
+	return sizes.total();
+}
 
-				if (r.shift == 0 && r.size == 2 && r.segment <= 12) {
+namespace {
 
-					int n = SUPER_INTERSEG12 + r.segment;
-					auto &sr = ss[n];
-					if (!sr) sr.emplace();
-					sr->append(r.offset);
+#ifdef _WIN32
+	struct iovec {
+		void *iov_base;
+		size_t iov_len;
+	};
+#endif
 
-					uint32_t value = r.segment_offset;
-					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
-					continue;
-				}
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-				if (r.shift == 0xf0 && r.size == 2 && r.segment <= 12) {
+	/*
+	 * gathers buffers and writes them with writev.
+	 * buffers must remain valid until flush().
+	 */
+	class iov_writer {
+	public:
+		iov_writer() = default;
+
+		void append(const void *data, size_t size) {
+			if (!size) return;
+			_iov.push_back(iovec{ const_cast<void *>(data), size });
+			_size += size;
+		}
 
-					int n = SUPER_INTERSEG24 + r.segment;
-					auto &sr = ss[n];
-					if (!sr) sr.emplace();
-					sr->append(r.offset);
+		void append(const std::vector<uint8_t> &v) {
+			append(v.data(), v.size());
+		}
 
-					uint32_t value = r.segment_offset;
-					for (int i = 0; i < 2; ++i, value >>= 8)
-						data[data_offset + r.offset + i] = value; 
-					continue;
-				}
+		void zero(size_t size) {
+			static uint8_t zero[4096];
+			while (size) {
+				size_t n = std::min(size, sizeof(zero));
+				append(zero, n);
+				size -= n;
 			}
-
-
-			push(data, (uint8_t)omf::cINTERSEG);
-			push(data, (uint8_t)r.size);
-			push(data, (uint8_t)r.shift);
-			push(data, (uint16_t)r.offset);
-			push(data, (uint8_t)r.segment);
-			push(data, (uint16_t)r.segment_offset);
-			reloc_size += 8;
-		} else {
-			push(data, (uint8_t)omf::INTERSEG);
-			push(data, (uint8_t)r.size);
-			push(data, (uint8_t)r.shift);
-			push(data, (uint32_t)r.offset);
-			push(data, (uint16_t)r.file);
-			push(data, (uint16_t)r.segment);
-			push(data, (uint32_t)r.segment_offset);
-			reloc_size += 15;
 		}
-	}
 
+		uint64_t size() const { return _size; }
 
-	for (int i = 0; i < ss.size(); ++i) {
-		auto &s = ss[i];
-		if (!s) continue;
+		// true if file has exactly the pending contents.
+		bool same(const mapped_file &file) const;
 
-		auto tmp = s->data();
-		if (tmp.empty()) continue;
+		// returns false (and sets errno) on failure.
+		bool flush(int fd);
 
-		reloc_size += tmp.size() + 6;
-		data.push_back(omf::SUPER);
-		push(data, ((uint32_t)tmp.size() + 1));
-		data.push_back(i);
+	private:
+		std::vector<iovec> _iov;
+		uint64_t _size = 0;
+	};
 
-		data.insert(data.end(), tmp.begin(), tmp.end());
+	bool iov_writer::same(const mapped_file &file) const {
+		if (file.size() != _size) return false;
+
+		const uint8_t *cp = file.data();
+		for (const auto &v : _iov) {
+			if (memcmp(cp, v.iov_base, v.iov_len)) return false;
+			cp += v.iov_len;
+		}
+		return true;
 	}
 
-	return reloc_size;
-}
+	bool iov_writer::flush(int fd) {
 
-void save_bin(const std::string &path, omf::segment &segment, uint32_t org) {
+		size_t i = 0;
+		while (i < _iov.size()) {
+#ifdef _WIN32
+			ssize_t ok = write(fd, _iov[i].iov_base, _iov[i].iov_len);
+#else
+			int count = std::min(_iov.size() - i, (size_t)IOV_MAX);
+			ssize_t ok = writev(fd, _iov.data() + i, count);
+#endif
+			if (ok < 0) {
+				if (errno == EINTR) continue;
+				return false;
+			}
 
-	int fd;
-	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
-	if (fd < 0) {
-		err(EX_CANTCREAT, "Unable to open %s", path.c_str());
+			// skip what was written, adjust any partial write.
+			size_t n = ok;
+			while (i < _iov.size() && n >= _iov[i].iov_len) {
+				n -= _iov[i].iov_len;
+				++i;
+			}
+			if (n) {
+				_iov[i].iov_base = (uint8_t *)_iov[i].iov_base + n;
+				_iov[i].iov_len -= n;
+			}
+		}
+		_iov.clear();
+		return true;
 	}
 
-	auto &data = segment.data;
+	/*
+	 * path "-" is stdout.  returns false (and leaves the file and its mtime
+	 * alone) if path already has the same contents, otherwise writes a
+	 * temporary file and renames it into place (see replace_file).
+	 */
+	bool write_file(const std::string &path, iov_writer &w, bool verbose) {
+
+		if (path == "-") {
+			if (!w.flush(STDOUT_FILENO))
+				err(EX_IOERR, "write %s", path.c_str());
+			return true;
+		}
 
-	for (auto &r : segment.relocs) {
+		{
+			mapped_file old;
+			if (old.open(path) && w.same(old)) {
+				if (verbose) printf("%s is unchanged\n", path.c_str());
+				return false;
+			}
+		}
 
-		uint32_t value = r.value + org;
-		value >>= -(int8_t)r.shift;
+		replace_file f;
+		if (!f.open(path)) {
+			err(EX_CANTCREAT, "Unable to create temporary file for %s", path.c_str());
+		}
 
-		unsigned offset = r.offset;
-		unsigned size = r.size;
-		while (size--) {
-			data[offset++] = value & 0xff;
-			value >>= 8;
+		if (!w.flush(f.fd())) {
+			int e = errno;
+			f.abort();
+			errno = e;
+			err(EX_IOERR, "write %s", path.c_str());
 		}
+
+		if (!f.commit()) {
+			err(EX_CANTCREAT, "Unable to replace %s", path.c_str());
+		}
+		return true;
 	}
 
-	auto ok = write(fd, data.data(), data.size());
-	if (ok < 0) {
-		close(fd);
-		err(EX_OSERR, "write %s", path.c_str());
+	// a slice of segment data and the records (ds, lconst opcode) following it.
+	struct data_span {
+		uint32_t offset = 0;
+		uint32_t size = 0;
+		std::vector<uint8_t> records;
+	};
+
+	// everything in a segment except the data itself.
+	struct segment_plan {
+		omf_header h;
+		std::vector<uint8_t> head; // names, lconst opcode
+		std::vector<data_span> spans;
+		uint32_t reserved_space = 0; // expanded into the lconst
+		std::vector<uint8_t> tail; // relocation records, end
+		reloc_sizes relocs;
+		uint32_t padding = 0; // v1 block padding
+	};
+
+	// a ds record and the lconst after it cost 10 bytes.
+	enum { kMinZeroRun = 32 };
+
+	/*
+	 * find runs of zeros that no relocation touches. interior runs of at least
+	 * kMinZeroRun bytes are added to runs; returns the data size without the
+	 * trailing run (which can become reserved space).
+	 */
+	uint32_t zero_runs(const omf::segment &seg, std::vector< std::pair<uint32_t, uint32_t> > &runs) {
+
+		std::vector< std::pair<uint32_t, uint32_t> > fixed;
+		fixed.reserve(seg.relocs.size() + seg.intersegs.size());
+		for (const auto &r : seg.relocs) fixed.emplace_back(r.offset, r.offset + r.size);
+		for (const auto &r : seg.intersegs) fixed.emplace_back(r.offset, r.offset + r.size);
+		std::sort(fixed.begin(), fixed.end());
+
+		const uint8_t *data = seg.data.data();
+		uint32_t size = seg.data.size();
+		size_t k = 0;
+		uint32_t i = 0;
+		while (i < size) {
+			if (data[i]) { ++i; continue; }
+
+			while (k < fixed.size() && fixed[k].second <= i) ++k;
+			if (k < fixed.size() && fixed[k].first <= i) {
+				i = fixed[k].second;
+				continue;
+			}
+
+			uint32_t end = size;
+			if (k < fixed.size()) end = std::min(end, fixed[k].first);
+			uint32_t j = i;
+			while (j < end && !data[j]) ++j;
+
+			if (j == size) return i;
+			if (j - i >= kMinZeroRun) runs.emplace_back(i, j);
+			i = j;
+		}
+		return size;
 	}
-	close(fd);
 }
 
 
-void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags) {
+/*
+ * the whole file is laid out first (so the ExpressLoad segment, which comes
+ * first but describes everything after it, can be generated up front) and
+ * then written sequentially with no seeking.  path "-" is stdout.
+ */
+bool save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags, unsigned threads) {
+
+	STATS_TIMER(SAVE_OMF);
 
 	// expressload doesn't support links to other files. 
 	// fortunately, we don't either.
@@ -489,19 +674,17 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 	bool compress = !(flags & OMF_NO_COMPRESS);
 	bool super = !(flags & OMF_NO_SUPER);
 	bool expressload = !(flags & OMF_NO_EXPRESS);
+	bool ds = !(flags & OMF_NO_DS);
 	bool v1 = flags & OMF_V1;
+	bool verbose = flags & OMF_VERBOSE;
 
 	if (v1) {
 		expressload = false;
 		super = false;
 	}
-
-	int fd;
-	fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
-	if (fd < 0) {
-		err(EX_CANTCREAT, "Unable to open %s", path.c_str());
-	}
-
+	// expressload needs the data in a single lconst, and its table entries
+	// have no reserved space (the segment length is the lconst length).
+	if (expressload) ds = false;
 
 	uint32_t offset = 0;
 	if (expressload) {
@@ -519,15 +702,20 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		for (auto &s : segments) {
 			offset += 8 + 2;
 			offset += sizeof(omf_express_header) + 10;
-			offset += s.segname.length() + 1;
+			offset += std::min(s.segname.length(), (size_t)255) + 1;
 		}
-
-		lseek(fd, offset, SEEK_SET);
 	}
+	uint32_t express_size = offset;
 
 
-	for (auto &s : segments) {
-		omf_header h;
+	std::vector<segment_plan> plans(segments.size());
+
+	// segments are encoded independently (and concurrently)...
+	parallel_for(segments.size(), threads, [&](size_t i){
+		auto &s = segments[i];
+		auto &p = plans[i];
+		auto &h = p.h;
+
 		h.length = s.data.size() + s.reserved_space;
 		h.kind = s.kind;
 		h.banksize = s.data.size() > 0xffff ? 0x0000 : 0x010000;
@@ -544,46 +732,75 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		// length field INCLUDES reserved space.  Express expand reserved space.
 
 
-		std::vector<uint8_t> data;
+		// zero runs become ds records; trailing zeros become reserved space.
+		std::vector< std::pair<uint32_t, uint32_t> > runs;
+		uint32_t data_size = s.data.size();
+		if (ds) {
+			data_size = zero_runs(s, runs);
+			h.reserved_space += s.data.size() - data_size;
+		}
+
+
+		auto &head = p.head;
 
 		// push segname and load name onto data.
 		// data.insert(data.end(), 10, ' ');
-		push(data, s.loadname, 10);
-		push(data, s.segname);
+		push(head, s.loadname, 10);
+		push(head, s.segname);
 
 		h.dispname = sizeof(omf_header);
-		h.dispdata = sizeof(omf_header) + data.size();
-
-
-
-		uint32_t lconst_offset = offset + sizeof(omf_header) + data.size() + 5;
-		uint32_t lconst_size = s.data.size() + reserved_space;
-
-
-		//lconst record
-		push(data, (uint8_t)omf::LCONST);
-		push(data, (uint32_t)lconst_size);
-
-		size_t data_offset = data.size();
-
-		data.insert(data.end(), s.data.begin(), s.data.end());
-
-		if (reserved_space) {
-			data.insert(data.end(), reserved_space, 0);
+		h.dispdata = sizeof(omf_header) + head.size();
+
+		// lconst and ds records
+		std::vector<uint8_t> *records = &head;
+		uint32_t pos = 0;
+		for (const auto &r : runs) {
+			if (r.first > pos) {
+				push(*records, (uint8_t)omf::LCONST);
+				push(*records, (uint32_t)(r.first - pos));
+				p.spans.emplace_back();
+				p.spans.back().offset = pos;
+				p.spans.back().size = r.first - pos;
+				records = &p.spans.back().records;
+			}
+			push(*records, (uint8_t)omf::DS);
+			push(*records, (uint32_t)(r.second - r.first));
+			pos = r.second;
+		}
+		if (runs.empty() || pos < data_size) {
+			push(*records, (uint8_t)omf::LCONST);
+			push(*records, (uint32_t)(data_size - pos + reserved_space));
+			p.spans.emplace_back();
+			p.spans.back().offset = pos;
+			p.spans.back().size = data_size - pos;
 		}
 
-		uint32_t reloc_offset = offset + sizeof(omf_header) + data.size();
-		uint32_t reloc_size = 0;
+		p.reserved_space = reserved_space;
 
-		reloc_size = add_relocs(data, data_offset, s, compress, super);
+		add_relocs(p.tail, s.data.data(), s, compress, super, p.relocs);
 
 		// end-of-record
-		push(data, (uint8_t)omf::END);
+		push(p.tail, (uint8_t)omf::END);
 
-		h.bytecount = data.size() + sizeof(omf_header);
+		uint32_t bytecount = sizeof(omf_header) + head.size();
+		for (const auto &span : p.spans) bytecount += span.size + span.records.size();
+		bytecount += reserved_space + p.tail.size();
+		h.bytecount = bytecount;
+	});
+
+	// ... then placed in order.
+	for (size_t i = 0; i < segments.size(); ++i) {
+		auto &s = segments[i];
+		auto &p = plans[i];
+		auto &h = p.h;
 
 		if (expressload) {
 
+			uint32_t lconst_offset = offset + sizeof(omf_header) + p.head.size();
+			uint32_t lconst_size = s.data.size() + p.reserved_space;
+			uint32_t reloc_offset = lconst_offset + lconst_size;
+			uint32_t reloc_size = p.relocs.total();
+
 			expr_offsets.emplace_back(expr_headers.size());
 
 			if (lconst_size == 0) lconst_offset = 0;
@@ -615,19 +832,26 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 			push(expr_headers, s.segname);
 		}
 
-		if (v1) to_v1(h);
-		to_little(h);
+		if (verbose) {
+			const auto &r = p.relocs;
+			printf("relocations %3d %-20s $%04x (reloc $%04x creloc $%04x interseg $%04x cinterseg $%04x super $%04x/%u)\n",
+				s.segnum, s.segname.c_str(), r.total(),
+				r.reloc, r.creloc, r.interseg, r.cinterseg, r.super, r.super_records);
+		}
 
-		offset += write(fd, &h, sizeof(h));
-		offset += write(fd, data.data(), data.size());
+		offset += h.bytecount;
 
 		// version 1 needs 512-byte padding for all but final segment.
-		if (v1 && &s != &segments.back()) {
-			static uint8_t zero[512];
-			offset += write(fd, zero, 512 - (offset & 511) );
+		if (v1 && i != segments.size() - 1) {
+			p.padding = 512 - (offset & 511);
+			offset += p.padding;
 		}
+
+		if (v1) to_v1(h);
+		to_little(h);
 	}
 
+	std::vector<uint8_t> express;
 	if (expressload) {
 		omf_header h;
 		h.segnum = 1;
@@ -667,11 +891,222 @@ void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsi
 		h.bytecount = data.size() + sizeof(omf_header);
 
 		to_little(h);
-		lseek(fd, 0, SEEK_SET);
-		write(fd, &h, sizeof(h));
-		write(fd, data.data(), data.size());
+		express.resize(sizeof(h));
+		memcpy(express.data(), &h, sizeof(h));
+		express.insert(express.end(), data.begin(), data.end());
+
+		assert(express.size() == express_size);
+	}
+
 
+	iov_writer w;
+	w.append(express);
+	for (size_t i = 0; i < segments.size(); ++i) {
+		const auto &p = plans[i];
+		w.append(&p.h, sizeof(p.h));
+		w.append(p.head);
+		for (const auto &span : p.spans) {
+			w.append(segments[i].data.data() + span.offset, span.size);
+			w.append(span.records);
+		}
+		w.zero(p.reserved_space);
+		w.append(p.tail);
+		w.zero(p.padding);
 	}
+	assert(w.size() == offset);
+
+	if (!write_file(path, w, verbose)) return false;
+
+	STATS_ADD(BYTES_WRITTEN, w.size());
+	return true;
+}
+
+
+namespace {
+
+	// store a resolved reference.
+	void patch(std::vector<uint8_t> &data, uint32_t offset, unsigned size, uint32_t value, uint8_t shift) {
+		int8_t n = shift;
+		if (n < 0) value >>= -n;
+		else value <<= n;
+
+		if (offset + size > data.size())
+			errx(EX_SOFTWARE, "Relocation at $%06x is out of range", offset);
+		for (unsigned i = 0; i < size; ++i, value >>= 8)
+			data[offset + i] = value & 0xff;
+	}
+
+	void push_hex(std::vector<uint8_t> &v, uint8_t x) {
+		static const char hex[] = "0123456789ABCDEF";
+		v.push_back(hex[x >> 4]);
+		v.push_back(hex[x & 0x0f]);
+	}
+
+	/*
+	 * Intel HEX: 16-byte data records (00) which never cross a 64K boundary,
+	 * preceded by an extended linear address record (04) when the upper 16
+	 * bits change.
+	 */
+	void intel_hex(std::vector<uint8_t> &out, const std::vector<omf::segment *> &segments) {
+
+		auto record = [&](uint8_t type, uint16_t address, const uint8_t *data, unsigned size) {
+			uint8_t sum = size + (address >> 8) + address + type;
+			out.push_back(':');
+			push_hex(out, size);
+			push_hex(out, address >> 8);
+			push_hex(out, address);
+			push_hex(out, type);
+			for (unsigned i = 0; i < size; ++i) {
+				push_hex(out, data[i]);
+				sum += data[i];
+			}
+			push_hex(out, -sum);
+			out.push_back('\n');
+		};
+
+		uint32_t upper = 0;
+		for (const auto seg : segments) {
+			const auto &data = seg->data;
+			uint32_t i = 0;
+			while (i < data.size()) {
+				uint32_t address = seg->org + i;
+				uint32_t n = std::min((uint32_t)data.size() - i, 16u);
+				n = std::min(n, 0x10000 - (address & 0xffff));
+
+				if ((address >> 16) != upper) {
+					upper = address >> 16;
+					uint8_t tmp[2] = { (uint8_t)(upper >> 8), (uint8_t)upper };
+					record(0x04, 0, tmp, 2);
+				}
+				record(0x00, address, data.data() + i, n);
+				i += n;
+			}
+		}
+		record(0x01, 0, nullptr, 0);
+	}
+
+	/*
+	 * Motorola S-records with 24-bit addresses: S0 header, S2 data, S8 with
+	 * the start address (the first segment).
+	 */
+	void s_record(std::vector<uint8_t> &out, const std::vector<omf::segment *> &segments) {
+
+		auto record = [&](char type, uint32_t address, unsigned width, const uint8_t *data, unsigned size) {
+			uint8_t count = width + size + 1;
+			uint8_t sum = count;
+			out.push_back('S');
+			out.push_back(type);
+			push_hex(out, count);
+			for (unsigned i = width; i--; ) {
+				uint8_t x = address >> (i * 8);
+				push_hex(out, x);
+				sum += x;
+			}
+			for (unsigned i = 0; i < size; ++i) {
+				push_hex(out, data[i]);
+				sum += data[i];
+			}
+			push_hex(out, ~sum);
+			out.push_back('\n');
+		};
+
+		record('0', 0, 2, nullptr, 0);
+		for (const auto seg : segments) {
+			const auto &data = seg->data;
+			for (uint32_t i = 0; i < data.size(); i += 16) {
+				uint32_t n = std::min((uint32_t)data.size() - i, 16u);
+				record('2', seg->org + i, 3, data.data() + i, n);
+			}
+		}
+		record('8', segments.empty() ? 0 : segments.front()->org, 3, nullptr, 0);
+	}
+}
+
+
+bool save_bin(const std::string &path, std::vector<omf::segment> &segments, unsigned format, unsigned flags) {
+
+	STATS_TIMER(SAVE_OMF);
+
+	bool verbose = flags & OMF_VERBOSE;
+
+	std::vector<const omf::segment *> by_number(segments.size() + 1);
+	for (const auto &seg : segments) {
+		if (seg.segnum >= by_number.size()) by_number.resize(seg.segnum + 1);
+		by_number[seg.segnum] = &seg;
+	}
+
+	// resolve everything.
+	for (auto &seg : segments) {
+		for (const auto &r : seg.relocs)
+			patch(seg.data, r.offset, r.size, r.value + seg.org, r.shift);
+
+		for (const auto &r : seg.intersegs) {
+			if (r.file != 1 || r.segment >= by_number.size() || !by_number[r.segment])
+				errx(EX_SOFTWARE, "Segment %u: invalid interseg reference to segment %u", seg.segnum, r.segment);
+			patch(seg.data, r.offset, r.size, r.segment_offset + by_number[r.segment]->org, r.shift);
+		}
+		seg.relocs.clear();
+		seg.intersegs.clear();
+	}
+
+	// address order.  reserved space is only checked for overlaps.
+	// reserved-only dp/stack segments (page0) live in the direct page, not
+	// the image, so they may share addresses with it.
+	std::vector<omf::segment *> placed;
+	for (auto &seg : segments) {
+		if ((seg.kind & 0x1f) == 0x12 && seg.data.empty()) continue;
+		placed.push_back(&seg);
+	}
+	std::stable_sort(placed.begin(), placed.end(), [](const omf::segment *a, const omf::segment *b){
+		return a->org < b->org;
+	});
+
+	uint64_t end = 0;
+	const omf::segment *prev = nullptr;
+	for (const auto seg : placed) {
+		uint64_t size = seg->data.size() + seg->reserved_space;
+		if (!size) continue;
+		if (prev && seg->org < end)
+			errx(EX_DATAERR, "Segments %s and %s overlap", prev->segname.c_str(), seg->segname.c_str());
+		if (seg->org + size > 0x1000000)
+			errx(EX_DATAERR, "Segment %s extends past $ffffff", seg->segname.c_str());
+		end = seg->org + size;
+		prev = seg;
+	}
+
+	placed.erase(std::remove_if(placed.begin(), placed.end(), [](const omf::segment *seg){
+		return seg->data.empty();
+	}), placed.end());
+
+	std::vector<uint8_t> text;
+	iov_writer w;
+
+	switch (format) {
+		case BIN_FLAT: {
+			// one image from the lowest address, gaps are zero-filled.
+			if (placed.empty()) break;
+			uint32_t address = placed.front()->org;
+			for (const auto seg : placed) {
+				w.zero(seg->org - address);
+				w.append(seg->data);
+				address = seg->org + seg->data.size();
+			}
+			break;
+		}
+		case BIN_INTEL_HEX:
+			intel_hex(text, placed);
+			w.append(text);
+			break;
+		case BIN_SREC:
+			s_record(text, placed);
+			w.append(text);
+			break;
+		default:
+			errx(EX_SOFTWARE, "Invalid binary format %u", format);
+	}
+
+	if (!write_file(path, w, verbose)) return false;
 
-	close(fd);
+	STATS_ADD(BYTES_WRITTEN, w.size());
+	return true;
 }
@@ -86,11 +86,28 @@ enum {
 	OMF_V2 = 0,
 	OMF_NO_SUPER = 2,
 	OMF_NO_COMPRESS = 4,
-	OMF_NO_EXPRESS = 8
+	OMF_NO_EXPRESS = 8,
+	OMF_NO_DS = 16,
+	OMF_VERBOSE = 32
 
 };
 
-void save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags);
+// path "-" is stdout. segment data is updated in place for SUPER relocations.
+// segments are encoded with up to threads threads. OMF_VERBOSE prints relocation sizes.
+// returns false (and doesn't touch the file) if path already has the same contents.
+bool save_omf(const std::string &path, std::vector<omf::segment> &segments, unsigned flags, unsigned threads = 1);
+
+enum {
+	// binary formats
+	BIN_FLAT,
+	BIN_INTEL_HEX,
+	BIN_SREC,
+};
+
+// each segment is placed at its org; relocs and intersegs are resolved in place and
+// reserved space isn't written. flags may include OMF_VERBOSE.
+// returns false (and doesn't touch the file) if path already has the same contents.
+bool save_bin(const std::string &path, std::vector<omf::segment> &segments, unsigned format, unsigned flags = 0);
 
 
 #endif
@@ -0,0 +1,407 @@
+#include "omf_reader.h"
+
+#include <err.h>
+#include <sysexits.h>
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+	// bounds-checked little-endian reader.
+	class cursor {
+	public:
+		cursor(const std::string &path, const uint8_t *begin, const uint8_t *end) :
+			_path(path), _begin(begin), _cp(begin), _end(end)
+		{}
+
+		size_t offset() const { return _cp - _begin; }
+		size_t remaining() const { return _end - _cp; }
+
+		void seek(size_t offset) {
+			if (offset > (size_t)(_end - _begin)) truncated();
+			_cp = _begin + offset;
+		}
+
+		uint8_t u8() {
+			need(1);
+			return *_cp++;
+		}
+
+		uint16_t u16() {
+			need(2);
+			uint16_t x = _cp[0] | (_cp[1] << 8);
+			_cp += 2;
+			return x;
+		}
+
+		uint32_t u32() {
+			need(4);
+			uint32_t x = _cp[0] | (_cp[1] << 8) | (_cp[2] << 16) | ((uint32_t)_cp[3] << 24);
+			_cp += 4;
+			return x;
+		}
+
+		const uint8_t *bytes(size_t n) {
+			need(n);
+			const uint8_t *tmp = _cp;
+			_cp += n;
+			return tmp;
+		}
+
+		// fixed-width (space padded) or pstring name.
+		std::string name(unsigned lablen) {
+			if (!lablen) lablen = u8();
+			const char *cp = (const char *)bytes(lablen);
+			std::string s(cp, cp + lablen);
+			while (!s.empty() && s.back() == ' ') s.pop_back();
+			return s;
+		}
+
+	private:
+
+		void need(size_t n) {
+			if (remaining() < n) truncated();
+		}
+
+		[[noreturn]] void truncated() {
+			errx(EX_DATAERR, "%s is truncated", _path.c_str());
+		}
+
+		const std::string &_path;
+		const uint8_t *_begin;
+		const uint8_t *_cp;
+		const uint8_t *_end;
+	};
+
+	enum {
+		kHeaderSize = 44,
+	};
+}
+
+
+bool omf_reader::open(const std::string &path) {
+	_path = path;
+	_offset = 0;
+	_express.clear();
+	return _file.open(path);
+}
+
+
+bool omf_reader::next(omf::segment &seg, header &h) {
+
+	if (_offset >= _file.size()) return false;
+
+	seg = omf::segment();
+	h = header();
+	h.offset = _offset;
+
+	size_t available = _file.size() - _offset;
+	cursor hc(_path, _file.data() + _offset, _file.data() + _file.size());
+
+	if (available < kHeaderSize)
+		errx(EX_DATAERR, "%s: truncated segment header at $%06x", _path.c_str(), h.offset);
+
+	uint32_t bytecount = hc.u32();
+	seg.reserved_space = hc.u32();
+	h.length = hc.u32();
+	uint8_t kind1 = hc.u8();
+	uint8_t lablen = hc.u8();
+	uint8_t numlen = hc.u8();
+	h.version = hc.u8();
+	h.banksize = hc.u32();
+	uint16_t kind2 = hc.u16();
+	hc.u16(); // unused
+	seg.org = hc.u32();
+	seg.alignment = hc.u32();
+	uint8_t numsex = hc.u8();
+	hc.u8(); // unused
+	seg.segnum = hc.u16();
+	h.entry = hc.u32();
+	uint16_t dispname = hc.u16();
+	uint16_t dispdata = hc.u16();
+
+	switch (h.version) {
+		case 1:
+			// block count and 1-byte kind
+			seg.kind = kind1;
+			bytecount *= 512;
+			// the last segment isn't padded.
+			bytecount = std::min((size_t)bytecount, available);
+			break;
+		case 2:
+			seg.kind = kind2;
+			break;
+		default:
+			errx(EX_DATAERR, "%s: segment at $%06x: unsupported OMF version %u",
+				_path.c_str(), h.offset, h.version);
+	}
+
+	if (numlen != 4 || numsex != 0)
+		errx(EX_DATAERR, "%s: segment %u: unsupported number format", _path.c_str(), seg.segnum);
+
+	if (bytecount < kHeaderSize || bytecount > available)
+		errx(EX_DATAERR, "%s: segment %u: invalid byte count $%06x", _path.c_str(), seg.segnum, bytecount);
+
+	if (dispname < kHeaderSize || dispname + 10 > dispdata || dispdata > bytecount)
+		errx(EX_DATAERR, "%s: segment %u: invalid header", _path.c_str(), seg.segnum);
+
+	h.bytecount = bytecount;
+
+	// only look at this segment.
+	cursor c(_path, _file.data() + _offset, _file.data() + _offset + bytecount);
+
+	c.seek(dispname);
+	seg.loadname = c.name(10);
+	seg.segname = c.name(lablen);
+
+	c.seek(dispdata);
+
+	std::vector< std::pair<uint8_t, uint32_t> > supers;
+	unsigned data_records = 0;
+	bool data_after_relocs = false;
+	size_t relocs_start = 0;
+
+	for(;;) {
+		size_t at = c.offset();
+		uint8_t op = c.u8();
+		h.records++;
+
+		if (op == omf::END) break;
+
+		if (op < omf::ALIGN) {
+			// CONST
+			const uint8_t *cp = c.bytes(op);
+			seg.data.insert(seg.data.end(), cp, cp + op);
+			h.const_bytes += op;
+			if (relocs_start) data_after_relocs = true;
+			data_records++;
+			continue;
+		}
+
+		switch (op) {
+			case omf::LCONST: {
+				uint32_t n = c.u32();
+				if (!data_records && !relocs_start) {
+					h.lconst_mark = n ? _offset + c.offset() : 0;
+					h.lconst_size = n;
+				}
+				const uint8_t *cp = c.bytes(n);
+				seg.data.insert(seg.data.end(), cp, cp + n);
+				h.const_bytes += n;
+				if (relocs_start) data_after_relocs = true;
+				data_records++;
+				break;
+			}
+
+			case omf::DS: {
+				uint32_t n = c.u32();
+				if (seg.data.size() + n > h.length) errx(EX_DATAERR, "%s: segment %u: invalid DS record", _path.c_str(), seg.segnum);
+				seg.data.resize(seg.data.size() + n, 0);
+				h.ds_bytes += n;
+				if (relocs_start) data_after_relocs = true;
+				data_records += 2; // not expressload compatible.
+				break;
+			}
+
+			case omf::RELOC: {
+				omf::reloc r;
+				r.size = c.u8();
+				r.shift = c.u8();
+				r.offset = c.u32();
+				r.value = c.u32();
+				seg.relocs.push_back(r);
+				h.reloc_records++;
+				break;
+			}
+
+			case omf::cRELOC: {
+				omf::reloc r;
+				r.size = c.u8();
+				r.shift = c.u8();
+				r.offset = c.u16();
+				r.value = c.u16();
+				seg.relocs.push_back(r);
+				h.reloc_records++;
+				break;
+			}
+
+			case omf::INTERSEG: {
+				omf::interseg r;
+				r.size = c.u8();
+				r.shift = c.u8();
+				r.offset = c.u32();
+				r.file = c.u16();
+				r.segment = c.u16();
+				r.segment_offset = c.u32();
+				seg.intersegs.push_back(r);
+				h.interseg_records++;
+				break;
+			}
+
+			case omf::cINTERSEG: {
+				omf::interseg r;
+				r.size = c.u8();
+				r.shift = c.u8();
+				r.offset = c.u16();
+				r.segment = c.u8();
+				r.segment_offset = c.u16();
+				seg.intersegs.push_back(r);
+				h.interseg_records++;
+				break;
+			}
+
+			case omf::SUPER: {
+				uint32_t n = c.u32();
+				if (n < 1) errx(EX_DATAERR, "%s: segment %u: invalid SUPER record", _path.c_str(), seg.segnum);
+				const uint8_t *cp = c.bytes(n);
+				uint8_t type = cp[0];
+				if (type > 37) errx(EX_DATAERR, "%s: segment %u: invalid SUPER type %u", _path.c_str(), seg.segnum, type);
+
+				// count - 1 followed by offsets within the page, or $80 | pages to skip.
+				uint32_t page = 0;
+				uint32_t i = 1;
+				while (i < n) {
+					uint8_t x = cp[i++];
+					if (x & 0x80) {
+						page += x & 0x7f;
+						continue;
+					}
+					unsigned count = x + 1;
+					if (i + count > n) errx(EX_DATAERR, "%s: segment %u: invalid SUPER record", _path.c_str(), seg.segnum);
+					h.super_entries += count;
+					while (count--) supers.emplace_back(type, (page << 8) | cp[i++]);
+					++page;
+				}
+				h.super_records++;
+				break;
+			}
+
+			default:
+				errx(EX_DATAERR, "%s: segment %u: unsupported record $%02x at $%06x",
+					_path.c_str(), seg.segnum, op, (uint32_t)(_offset + at));
+		}
+
+		if (!relocs_start && op != omf::LCONST && op != omf::DS) relocs_start = at;
+	}
+
+	h.express_ok = data_records == 1 && h.lconst_size == seg.data.size() && !data_after_relocs;
+	if (h.express_ok && relocs_start) {
+		h.reloc_mark = _offset + relocs_start;
+		h.reloc_size = c.offset() - 1 - relocs_start;
+	}
+
+	// SUPER values live in the segment data.
+	for (const auto &x : supers) {
+		unsigned type = x.first;
+		uint32_t offset = x.second;
+		unsigned size = type == 0 || type >= 14 ? 2 : 3;
+		if (offset + size > seg.data.size())
+			errx(EX_DATAERR, "%s: segment %u: SUPER offset $%06x out of range", _path.c_str(), seg.segnum, offset);
+
+		const uint8_t *cp = seg.data.data() + offset;
+		uint32_t value = cp[0] | (cp[1] << 8);
+
+		if (type < 2) {
+			// RELOC2, RELOC3
+			omf::reloc r;
+			r.size = size;
+			r.offset = offset;
+			r.value = type == 1 ? value | (cp[2] << 16) : value;
+			seg.relocs.push_back(r);
+			continue;
+		}
+
+		omf::interseg r;
+		r.offset = offset;
+		r.size = size;
+		r.segment_offset = value;
+		if (type < 14) {
+			// INTERSEG1-12: file number, segment number in the high byte.
+			r.file = type - 1;
+			r.segment = cp[2];
+		} else if (type < 26) {
+			// INTERSEG13-24
+			r.segment = type - 13;
+		} else {
+			// INTERSEG25-36: bank byte
+			r.segment = type - 25;
+			r.shift = 0xf0;
+		}
+		seg.intersegs.push_back(r);
+	}
+
+	auto by_offset = [](const auto &a, const auto &b){ return a.offset < b.offset; };
+	std::stable_sort(seg.relocs.begin(), seg.relocs.end(), by_offset);
+	std::stable_sort(seg.intersegs.begin(), seg.intersegs.end(), by_offset);
+
+	if (h.length != seg.data.size() + seg.reserved_space)
+		warnx("%s: segment %u: length $%06x doesn't match contents ($%06x)",
+			_path.c_str(), seg.segnum, h.length, (uint32_t)(seg.data.size() + seg.reserved_space));
+
+	_offset += bytecount;
+
+	if (is_express(seg)) read_express(seg);
+
+	return true;
+}
+
+
+void omf_reader::read_express(const omf::segment &seg) {
+
+	/*
+	 * l: reserved
+	 * w: segment count - 1
+	 * segment count * (w: self-relative offset to header, w: 0, l: 0)
+	 * segment count * (w: segment number)
+	 * segment count * (expressload header, loadname, segname)
+	 */
+
+	_express.clear();
+	cursor c(_path, seg.data.data(), seg.data.data() + seg.data.size());
+
+	c.u32();
+	unsigned count = c.u16() + 1;
+
+	std::vector<size_t> offsets;
+	offsets.reserve(count);
+	for (unsigned i = 0; i < count; ++i) {
+		size_t at = c.offset();
+		offsets.push_back(at + c.u16());
+		c.u16();
+		c.u32();
+	}
+
+	_express.resize(count);
+	for (auto &e : _express) e.segnum = c.u16();
+
+	for (unsigned i = 0; i < count; ++i) {
+		auto &e = _express[i];
+		c.seek(offsets[i]);
+
+		e.lconst_mark = c.u32();
+		e.lconst_size = c.u32();
+		e.reloc_mark = c.u32();
+		e.reloc_size = c.u32();
+
+		c.u8(); // unused
+		uint8_t lablen = c.u8();
+		c.u8(); // numlen
+		c.u8(); // version
+		e.banksize = c.u32();
+		e.kind = c.u16();
+		c.u16(); // unused
+		e.org = c.u32();
+		e.alignment = c.u32();
+		c.u8(); // numsex
+		c.u8(); // unused
+		e.header_segnum = c.u16();
+		e.entry = c.u32();
+		c.u16(); // dispname
+		c.u16(); // dispdata
+
+		c.name(10); // loadname
+		e.segname = c.name(lablen);
+	}
+}
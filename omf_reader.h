@@ -0,0 +1,93 @@
+#ifndef __omf_reader_h__
+#define __omf_reader_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "omf.h"
+#include "mapped_file.h"
+
+/*
+ * reads an OMF load file (version 1 or 2) one segment at a time.
+ *
+ * LCONST, CONST and DS records are expanded into the segment data.
+ * RELOC, cRELOC, INTERSEG, cINTERSEG and SUPER records are decoded into
+ * relocs and intersegs (SUPER values are taken from the segment data, as
+ * the loader does).  The ExpressLoad segment is returned like any other
+ * segment and its table is decoded into express().
+ *
+ * malformed files are fatal (errx).
+ */
+class omf_reader {
+
+public:
+
+	// header fields that don't fit in omf::segment.
+	struct header {
+		uint32_t offset = 0; // file offset
+		uint32_t bytecount = 0; // bytes in the file, including v1 padding
+		uint32_t length = 0;
+		uint8_t version = 0;
+		uint32_t banksize = 0;
+		uint32_t entry = 0;
+
+		unsigned records = 0;
+		unsigned reloc_records = 0; // RELOC, cRELOC
+		unsigned interseg_records = 0; // INTERSEG, cINTERSEG
+		unsigned super_records = 0;
+		uint32_t super_entries = 0;
+		uint32_t const_bytes = 0; // LCONST, CONST
+		uint32_t ds_bytes = 0;
+
+		// only set if the body is a single lconst followed by relocation
+		// records, which is what ExpressLoad expects.
+		bool express_ok = false;
+		uint32_t lconst_mark = 0;
+		uint32_t lconst_size = 0;
+		uint32_t reloc_mark = 0;
+		uint32_t reloc_size = 0;
+	};
+
+	struct express_entry {
+		uint16_t segnum = 0; // from the segment number list
+		uint32_t lconst_mark = 0;
+		uint32_t lconst_size = 0;
+		uint32_t reloc_mark = 0;
+		uint32_t reloc_size = 0;
+
+		uint16_t kind = 0;
+		uint32_t banksize = 0;
+		uint32_t org = 0;
+		uint32_t alignment = 0;
+		uint16_t header_segnum = 0;
+		uint32_t entry = 0;
+		std::string segname;
+	};
+
+	omf_reader() = default;
+	omf_reader(const omf_reader &) = delete;
+	omf_reader &operator=(const omf_reader &) = delete;
+
+	// returns false (and sets errno) if the file can't be opened.
+	bool open(const std::string &path);
+
+	// returns false at the end of the file.
+	bool next(omf::segment &seg, header &h);
+
+	const std::vector<express_entry> &express() const { return _express; }
+
+	static bool is_express(const omf::segment &seg) { return seg.segname == "~ExpressLoad"; }
+
+private:
+
+	void read_express(const omf::segment &seg);
+
+	std::string _path;
+	mapped_file _file;
+	size_t _offset = 0;
+	std::vector<express_entry> _express;
+};
+
+#endif
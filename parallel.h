@@ -0,0 +1,39 @@
+#ifndef __parallel_h__
+#define __parallel_h__
+
+#include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+/*
+ * call fn(i) for i in [0, count) using up to threads threads.
+ * the calling thread does its share of the work. with 1 thread (or 1 item)
+ * everything runs in order on the calling thread.
+ */
+template<class F>
+void parallel_for(size_t count, unsigned threads, F fn) {
+
+	if (threads <= 1 || count <= 1) {
+		for (size_t i = 0; i < count; ++i) fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for(;;) {
+			size_t i = next++;
+			if (i >= count) break;
+			fn(i);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	threads = std::min((size_t)threads, count);
+	for (unsigned i = 1; i < threads; ++i) pool.emplace_back(worker);
+	worker();
+	for (auto &t : pool) t.join();
+}
+
+#endif
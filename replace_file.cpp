@@ -0,0 +1,114 @@
+#include "replace_file.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace {
+
+	// follow symlinks so the target is replaced rather than the link.
+	std::string resolve(const std::string &path) {
+#ifndef _WIN32
+		std::string rv = path;
+		for (unsigned depth = 0; depth < 32; ++depth) {
+			struct stat st;
+			if (lstat(rv.c_str(), &st) < 0 || !S_ISLNK(st.st_mode)) break;
+
+			std::vector<char> buffer(st.st_size ? st.st_size + 1 : PATH_MAX);
+			ssize_t n = readlink(rv.c_str(), buffer.data(), buffer.size());
+			if (n < 0 || n == (ssize_t)buffer.size()) break;
+			std::string link(buffer.data(), n);
+
+			if (link[0] != '/') {
+				auto pos = rv.rfind('/');
+				if (pos != rv.npos) link = rv.substr(0, pos + 1) + link;
+			}
+			rv = std::move(link);
+		}
+		return rv;
+#else
+		return path;
+#endif
+	}
+
+	int default_mode() {
+		// umask can only be read by setting it.
+		static int mode = [](){
+			mode_t m = umask(0);
+			umask(m);
+			return 0666 & ~m;
+		}();
+		return mode;
+	}
+}
+
+replace_file::~replace_file() {
+	abort();
+}
+
+bool replace_file::open(const std::string &path) {
+	abort();
+
+	_path = resolve(path);
+
+	struct stat st;
+	_mode = stat(_path.c_str(), &st) == 0 ? st.st_mode & 07777 : default_mode();
+
+	auto pos = _path.rfind('/');
+	_tmp = (pos == _path.npos ? std::string() : _path.substr(0, pos + 1)) + ".wdc.XXXXXX";
+
+#ifndef _WIN32
+	_fd = mkstemp(&_tmp[0]);
+#else
+	_fd = -1;
+	if (_mktemp(&_tmp[0]))
+		_fd = ::open(_tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0666);
+#endif
+	if (_fd < 0) {
+		_tmp.clear();
+		return false;
+	}
+	return true;
+}
+
+bool replace_file::commit() {
+	if (_fd < 0) { errno = EBADF; return false; }
+
+	bool ok = true;
+#ifndef _WIN32
+	if (fchmod(_fd, _mode) < 0) ok = false;
+#endif
+	if (close(_fd) < 0) ok = false;
+	_fd = -1;
+
+#ifdef _WIN32
+	if (ok) unlink(_path.c_str());
+#endif
+	if (ok && rename(_tmp.c_str(), _path.c_str()) < 0) ok = false;
+
+	if (!ok) {
+		int e = errno;
+		unlink(_tmp.c_str());
+		errno = e;
+	}
+	_tmp.clear();
+	return ok;
+}
+
+void replace_file::abort() {
+	if (_fd >= 0) close(_fd);
+	if (!_tmp.empty()) unlink(_tmp.c_str());
+	_fd = -1;
+	_tmp.clear();
+}
@@ -0,0 +1,45 @@
+#ifndef __replace_file_h__
+#define __replace_file_h__
+
+#include <string>
+
+/*
+ * writes a new version of a file without disturbing the old one until
+ * it's complete. data goes to a uniquely named (mkstemp) temporary in the
+ * same directory, which is renamed over the original on commit.
+ *
+ * the old file's permissions are kept (new files get 0666 & ~umask).
+ * if the path is a symlink, the file it points to is replaced and the
+ * link is left alone.
+ */
+class replace_file {
+
+public:
+
+	replace_file() = default;
+	replace_file(const replace_file &) = delete;
+	replace_file &operator=(const replace_file &) = delete;
+	~replace_file();
+
+	// returns false (and sets errno) on failure.
+	bool open(const std::string &path);
+
+	// closes and renames into place. on failure, the temporary is
+	// removed and errno is set.
+	bool commit();
+
+	// closes and removes the temporary.
+	void abort();
+
+	int fd() const { return _fd; }
+	const std::string &tmp() const { return _tmp; }
+
+private:
+
+	std::string _path;
+	std::string _tmp;
+	int _fd = -1;
+	int _mode = -1;
+};
+
+#endif
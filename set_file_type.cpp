@@ -12,6 +12,10 @@ int set_file_type(const std::string &path, uint16_t file_type, uint32_t aux_type
 	if (!fi.open(path, afp::finder_info::read_write, ec))
 		return -1;
 
+	// don't touch the metadata if it's already correct.
+	if (fi.prodos_file_type() == file_type && fi.prodos_aux_type() == aux_type)
+		return 0;
+
 	fi.set_prodos_file_type(file_type, aux_type);
 	if (!fi.write(ec))
 		return -1;
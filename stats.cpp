@@ -0,0 +1,89 @@
+#include "stats.h"
+
+#include <atomic>
+
+namespace stats {
+
+namespace {
+
+	const char *phase_names[] = {
+		"parse",
+		"libraries",
+		"generate_end",
+		"simplify",
+		"build_omf_segments",
+		"save_omf",
+	};
+
+	const char *counter_names[] = {
+		"modules",
+		"symbols",
+		"expressions",
+		"relocs",
+		"intersegs",
+		"super_records",
+		"bytes_written",
+	};
+
+	static_assert(sizeof(phase_names) / sizeof(phase_names[0]) == PHASE_COUNT, "phase names");
+	static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == COUNTER_COUNT, "counter names");
+
+	struct {
+		double wall = 0;
+		double cpu = 0;
+	} times[PHASE_COUNT];
+
+	std::atomic<uint64_t> counters[COUNTER_COUNT];
+}
+
+void add(counter c, uint64_t n) {
+	counters[c] += n;
+}
+
+void set(counter c, uint64_t n) {
+	counters[c] = n;
+}
+
+void add_time(phase p, double wall, double cpu) {
+	times[p].wall += wall;
+	times[p].cpu += cpu;
+}
+
+void report(FILE *fp, bool json) {
+
+	double wall = 0;
+	double cpu = 0;
+	for (const auto &t : times) {
+		wall += t.wall;
+		cpu += t.cpu;
+	}
+
+	if (json) {
+		fprintf(fp, "{\n  \"phases\": {\n");
+		for (int i = 0; i < PHASE_COUNT; ++i) {
+			fprintf(fp, "    \"%s\": { \"wall\": %.6f, \"cpu\": %.6f },\n",
+				phase_names[i], times[i].wall, times[i].cpu);
+		}
+		fprintf(fp, "    \"total\": { \"wall\": %.6f, \"cpu\": %.6f }\n", wall, cpu);
+		fprintf(fp, "  },\n  \"counters\": {\n");
+		for (int i = 0; i < COUNTER_COUNT; ++i) {
+			fprintf(fp, "    \"%s\": %llu%s\n",
+				counter_names[i], (unsigned long long)counters[i],
+				i == COUNTER_COUNT - 1 ? "" : ",");
+		}
+		fprintf(fp, "  }\n}\n");
+		return;
+	}
+
+	fprintf(fp, "%-20s %12s %12s\n", "phase", "wall (s)", "cpu (s)");
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		fprintf(fp, "%-20s %12.6f %12.6f\n", phase_names[i], times[i].wall, times[i].cpu);
+	}
+	fprintf(fp, "%-20s %12.6f %12.6f\n", "total", wall, cpu);
+	fputs("\n", fp);
+	for (int i = 0; i < COUNTER_COUNT; ++i) {
+		fprintf(fp, "%-20s %12llu\n", counter_names[i], (unsigned long long)counters[i]);
+	}
+}
+
+}
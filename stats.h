@@ -0,0 +1,84 @@
+#ifndef __stats_h__
+#define __stats_h__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <ctime>
+
+/*
+ * per-phase timing and counters for wdclink --stats.
+ *
+ * build with -DNO_STATS to compile it all out.
+ */
+namespace stats {
+
+	enum phase {
+		PARSE,
+		LIBRARIES,
+		GENERATE_END,
+		SIMPLIFY,
+		BUILD_OMF,
+		SAVE_OMF,
+		PHASE_COUNT
+	};
+
+	enum counter {
+		MODULES,
+		SYMBOLS,
+		EXPRESSIONS,
+		RELOCS,
+		INTERSEGS,
+		SUPER_RECORDS,
+		BYTES_WRITTEN,
+		COUNTER_COUNT
+	};
+
+#ifdef NO_STATS
+	constexpr bool enabled = false;
+#else
+	constexpr bool enabled = true;
+#endif
+
+	// thread safe.
+	void add(counter c, uint64_t n);
+	void set(counter c, uint64_t n);
+
+	void add_time(phase p, double wall, double cpu);
+
+	void report(FILE *fp, bool json);
+
+
+	// times a phase (cumulative) from construction to destruction.
+	class timer {
+	public:
+		timer(phase p) : _phase(p),
+			_wall(std::chrono::steady_clock::now()), _cpu(std::clock())
+		{}
+
+		~timer() {
+			std::chrono::duration<double> wall = std::chrono::steady_clock::now() - _wall;
+			add_time(_phase, wall.count(), (double)(std::clock() - _cpu) / CLOCKS_PER_SEC);
+		}
+
+		timer(const timer &) = delete;
+		timer &operator=(const timer &) = delete;
+
+	private:
+		phase _phase;
+		std::chrono::steady_clock::time_point _wall;
+		std::clock_t _cpu;
+	};
+}
+
+#ifdef NO_STATS
+#define STATS_ADD(c, n) ((void)0)
+#define STATS_SET(c, n) ((void)0)
+#define STATS_TIMER(p) ((void)0)
+#else
+#define STATS_ADD(c, n) stats::add(stats::c, (n))
+#define STATS_SET(c, n) stats::set(stats::c, (n))
+#define STATS_TIMER(p) stats::timer stats_timer_ ## p(stats::p)
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+#include "string_pool.h"
+
+#include <algorithm>
+
+namespace {
+	enum {
+		kBlockSize = 64 * 1024,
+	};
+}
+
+uint32_t string_pool::hash(const char *cp, size_t size) {
+	uint32_t h = 0x811c9dc5;
+	while (size--) {
+		h ^= (uint8_t)*cp++;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+string_pool::string_pool() {
+	rehash(1024);
+	intern("", 0);
+}
+
+const char *string_pool::store(const char *cp, size_t size) {
+
+	if (size + 1 > _available) {
+		size_t block = std::max(size + 1, (size_t)kBlockSize);
+		_blocks.emplace_back(new char[block]);
+		_free = _blocks.back().get();
+		_available = block;
+	}
+
+	char *rv = _free;
+	memcpy(rv, cp, size);
+	rv[size] = 0;
+	_free += size + 1;
+	_available -= size + 1;
+	return rv;
+}
+
+void string_pool::rehash(size_t buckets) {
+
+	_table.clear();
+	_table.resize(buckets, 0);
+
+	size_t mask = buckets - 1;
+	for (uint32_t id = 0; id < _entries.size(); ++id) {
+		size_t i = _entries[id].hash & mask;
+		while (_table[i]) i = (i + 1) & mask;
+		_table[i] = id + 1;
+	}
+}
+
+bool string_pool::find(const char *cp, size_t size, uint32_t &id) const {
+
+	uint32_t h = hash(cp, size);
+	size_t mask = _table.size() - 1;
+	for (size_t i = h & mask; _table[i]; i = (i + 1) & mask) {
+		const entry &e = _entries[_table[i] - 1];
+		if (e.hash == h && e.length == size && !memcmp(e.data, cp, size)) {
+			id = _table[i] - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t string_pool::intern(const char *cp, size_t size) {
+
+	uint32_t h = hash(cp, size);
+	size_t mask = _table.size() - 1;
+	size_t i;
+	for (i = h & mask; _table[i]; i = (i + 1) & mask) {
+		const entry &e = _entries[_table[i] - 1];
+		if (e.hash == h && e.length == size && !memcmp(e.data, cp, size))
+			return _table[i] - 1;
+	}
+
+	uint32_t id = _entries.size();
+	_entries.push_back(entry{ store(cp, size), (uint32_t)size, h });
+
+	// keep the load factor under 1/2.
+	if (_entries.size() * 2 > _table.size()) rehash(_table.size() * 2);
+	else _table[i] = id + 1;
+
+	return id;
+}
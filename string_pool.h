@@ -0,0 +1,64 @@
+#ifndef __string_pool_h__
+#define __string_pool_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+/*
+ * link-wide string interning.
+ *
+ * each distinct string is stored once (nul-terminated, so c_str() is stable)
+ * and identified by a dense 32-bit id. the hash is computed once, when the
+ * string is interned. id 0 is always the empty string.
+ *
+ * not thread safe.
+ */
+class string_pool {
+
+public:
+
+	string_pool();
+	string_pool(const string_pool &) = delete;
+	string_pool &operator=(const string_pool &) = delete;
+
+	uint32_t intern(const char *cp, size_t size);
+	uint32_t intern(const char *cp) { return intern(cp, strlen(cp)); }
+	uint32_t intern(const std::string &s) { return intern(s.data(), s.size()); }
+
+	// returns false if not present.
+	bool find(const char *cp, size_t size, uint32_t &id) const;
+
+	const char *c_str(uint32_t id) const { return _entries[id].data; }
+	size_t length(uint32_t id) const { return _entries[id].length; }
+	uint32_t hash(uint32_t id) const { return _entries[id].hash; }
+	std::string str(uint32_t id) const { return std::string(_entries[id].data, _entries[id].length); }
+
+	size_t size() const { return _entries.size(); }
+
+	// FNV-1a. also the library index hash, so changing it invalidates .idx files.
+	static uint32_t hash(const char *cp, size_t size);
+
+private:
+
+	struct entry {
+		const char *data;
+		uint32_t length;
+		uint32_t hash;
+	};
+
+	const char *store(const char *cp, size_t size);
+	void rehash(size_t buckets);
+
+	std::vector<entry> _entries;
+	std::vector<uint32_t> _table; // id + 1, 0 = empty.
+
+	std::vector< std::unique_ptr<char[]> > _blocks;
+	char *_free = nullptr;
+	size_t _available = 0;
+};
+
+#endif
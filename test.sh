@@ -0,0 +1,162 @@
+#!/bin/bash
+#
+# make test -- regression checks against the samples and generated programs.
+#
+# WDCLINK, WDCDUMPOBJ, WDCGENOBJ, WDCLOADSIM (./wdclink, ./wdcdumpobj,
+# ./wdcgenobj, ./wdcloadsim) may be overridden.
+#
+
+LINK=${WDCLINK:-./wdclink}
+DUMPOBJ=${WDCDUMPOBJ:-./wdcdumpobj}
+GENOBJ=${WDCGENOBJ:-./wdcgenobj}
+LOADSIM=${WDCLOADSIM:-./wdcloadsim}
+
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+
+failed=0
+fail() {
+	echo "FAIL: $*" >&2
+	failed=1
+}
+
+# first n bytes of a file as hex.
+bytes() {
+	od -An -tx1 -N$2 "$1" | tr -d ' \n'
+}
+
+
+# -H: page0 (reserved, direct page) defaults to 0 along with code.
+if $LINK -H b -o "$T/ref_only.bin" samples/ref_only.obj ; then
+	# lda offset_0 / lda offset_2
+	[ "$(bytes "$T/ref_only.bin" 4)" = "a500a502" ] || fail "-H b: page0 references"
+else
+	fail "-H b: page0 overlaps code"
+fi
+
+
+# wdclink over a generated program (more than 12 segments, libraries that
+# reference each other). every option has to load the same image.
+G="$T/gen"
+mkdir "$G"
+$GENOBJ -o "$G" -m 6 -b 512 -n 30 -l 2 -L 30 -r 11
+
+# link out flags...
+link() {
+	local out=$1
+	shift
+	$LINK "$@" -o "$T/$out" -L "$G" -l lib0 -l lib1 "$G"/obj*.obj > "$T/$out.log" 2>&1 || fail "wdclink $* failed"
+	grep -q "Unable to resolve" "$T/$out.log" && fail "wdclink $*: unresolved symbols"
+}
+
+# segment name and checksum of the loaded image, placed by name.
+image() {
+	$LOADSIM -v -n "$T/$1" | grep '^ *[0-9][0-9]* ' | awk '{ print substr($0, 7, 20), $NF }' | sort
+}
+
+# segment names, in segment number order.
+segments() {
+	$LOADSIM -v "$T/$1" | grep '^ *[0-9][0-9]* ' | awk '{ print substr($0, 7, 20) }'
+}
+
+# total of a summary line.
+total() {
+	$LOADSIM "$T/$1" | awk -v k="$2" '$0 ~ "^  " k { print $(NF) }' | sed 's/[()]//g'
+}
+
+link base.omf -j1
+link j4.omf -j4
+cmp -s "$T/base.omf" "$T/j4.omf" || fail "-j4 output differs from -j1"
+
+# -C: no SUPER records (and no renumbering).
+link c.omf -C
+[ "$(image base.omf)" = "$(image c.omf)" ] || fail "-C: loaded image differs"
+[ "$(segments base.omf)" != "$(segments c.omf)" ] || fail "segments weren't renumbered"
+[ "$(total base.omf relocations)" = "$(total c.omf relocations)" ] || fail "-C: relocation count differs"
+
+# -X: DS records and reserved space; -Z turns them off.
+link x.omf -X -j1
+link xj4.omf -X -j4
+link xz.omf -X -Z
+cmp -s "$T/x.omf" "$T/xj4.omf" || fail "-X -j4 output differs from -j1"
+[ "$(image base.omf)" = "$(image x.omf)" ] || fail "-X: loaded image differs"
+[ "$(image base.omf)" = "$(image xz.omf)" ] || fail "-X -Z: loaded image differs"
+[ "$($LOADSIM "$T/x.omf" | awk '/bytes zeroed/ { print $3 }')" != 0 ] || fail "-X: no DS or reserved space"
+[ "$($LOADSIM "$T/xz.omf" | awk '/bytes zeroed/ { print $3 }')" = 0 ] || fail "-X -Z: DS or reserved space"
+[ $(wc -c < "$T/x.omf") -lt $(wc -c < "$T/xz.omf") ] || fail "-X: DS records didn't shrink the file"
+
+# -P: fewer segments, same bytes.
+link p.omf -P -j1
+link pj4.omf -P -j4
+cmp -s "$T/p.omf" "$T/pj4.omf" || fail "-P -j4 output differs from -j1"
+[ $(segments p.omf | wc -l) -lt $(segments base.omf | wc -l) ] || fail "-P didn't pack"
+$LOADSIM "$T/p.omf" 2>&1 | grep -q unresolved && fail "-P: unresolved intersegs"
+
+# libraries are searched together: lib0 references lib1, so strict (-s)
+# order fails when lib1 comes first and the default search doesn't.
+$LINK -o "$T/r.omf" -L "$G" -l lib1 -l lib0 "$G"/obj*.obj 2>&1 | grep -q "Unable to resolve" && fail "library search order"
+$LINK -s -o "$T/r.omf" -L "$G" -l lib1 -l lib0 "$G"/obj*.obj 2>&1 | grep -q "Unable to resolve" || fail "-s: corpus doesn't need a global search"
+
+# -i builds the .idx files; later links use them and get the same output.
+link i.omf -i
+[ -f "$G/lib0.lib.idx" ] && [ -f "$G/lib1.lib.idx" ] || fail "-i: no index"
+link ii.omf
+cmp -s "$T/base.omf" "$T/i.omf" && cmp -s "$T/base.omf" "$T/ii.omf" || fail "indexed link differs"
+
+# ... but not once the library has changed.
+mkdir "$G/other"
+$GENOBJ -o "$G/other" -m 1 -l 2 -L 30 -r 12
+cp -p "$G/lib0.lib" "$G/lib0.save"
+cp "$G/other/lib0.lib" "$G/lib0.lib"
+link stale.omf
+mv "$G/lib0.lib.idx" "$G/lib0.idx.save"
+link fresh.omf
+cmp -s "$T/stale.omf" "$T/fresh.omf" || fail "stale index used"
+cp -p "$G/lib0.save" "$G/lib0.lib"
+
+# a damaged index (every bucket full) can't hang the link.
+if command -v timeout > /dev/null ; then
+	idx="$G/lib0.idx.save"
+	size=$(wc -c < "$idx")
+	buckets=$(od -An -tu4 -j32 -N4 "$idx" | tr -d ' ')
+	{
+		head -c 48 "$idx"
+		head -c $((buckets * 12)) /dev/zero | tr '\0' '\1'
+		tail -c $((size - 48 - buckets * 12)) "$idx"
+	} > "$G/lib0.lib.idx"
+	timeout 60 $LINK -o "$T/bad.omf" -L "$G" -l lib0 -l lib1 "$G"/obj*.obj > /dev/null 2>&1
+	[ $? = 124 ] && fail "damaged index hangs the link"
+fi
+
+
+# wdcdumpobj: every local label it refers to is defined.
+$GENOBJ -o "$T" -m 20 -l 0 -b 8192 -r 7
+for f in "$T"/obj*.obj ; do
+	out=$($DUMPOBJ "$f" 2>"$T/err")
+	grep -q "symbol @L" "$T/err" && fail "$f: unplaced local label"
+	used=$(echo "$out" | sed 's/;.*//' | grep '^ ' | grep -o '@L[0-9a-f]*' | sort -u)
+	defined=$(echo "$out" | grep -o '^@L[0-9a-f]*' | sort -u)
+	[ -z "$(comm -23 <(echo "$used") <(echo "$defined"))" ] || fail "$f: undefined local label"
+done
+
+
+# wdcdumpobj: without longa/longi records, m/x follows the branch around data.
+#	sep #$20 / bra L / brk $00 / L: lda #$12 / rtl
+printf 'ZRDZ\001\000\001\002\013\000\000\000\017\000\000\000\000\000\000\000\001\001\000\000t\000' > "$T/mx.obj"
+printf '\011\342\040\200\002\000\000\251\022\153\000' >> "$T/mx.obj"
+printf '\001\000\011\000\000\000\000\000\000\000CODE\000' >> "$T/mx.obj"
+$DUMPOBJ "$T/mx.obj" | grep -q 'lda *#\$12 ' || fail "wdcdumpobj: m/x not inferred"
+
+# replacing the output keeps its mode and any symlink to it.
+$LINK -H b -o "$T/mode.bin" samples/ref_only.obj
+chmod 640 "$T/mode.bin"
+ln -s mode.bin "$T/link.bin"
+echo > "$T/mode.bin"
+$LINK -H b -o "$T/link.bin" samples/ref_only.obj
+[ -L "$T/link.bin" ] || fail "output symlink replaced"
+[ "$(bytes "$T/mode.bin" 4)" = "a500a502" ] || fail "symlink target not written"
+[ "$(stat -c %a "$T/mode.bin" 2>/dev/null || stat -f %Lp "$T/mode.bin")" = 640 ] || fail "output mode not kept"
+[ -z "$(ls -A "$T" | grep '^\.wdc\.')" ] || fail "temporary file left behind"
+
+if [ $failed = 0 ] ; then echo "ok" ; fi
+exit $failed
@@ -28,6 +28,15 @@ zrdz_disassembler::zrdz_disassembler(std::vector<section> &&sections, std::vecto
 		_sections[s.number] = std::move(s);
 	}
 
+	// location_name() index. the first symbol wins.
+	_labels.reserve(_symbols.size());
+	for (unsigned i = 0; i < _symbols.size(); ++i) {
+		const auto &s = _symbols[i];
+		if (s.type == equ_type) continue;
+		if (s.type == S_UND) continue;
+		_labels.emplace(((uint64_t)s.section << 32) | s.offset, i);
+	}
+
 	for (auto &s : _symbols) {
 
 		if (s.type == S_UND) continue;
@@ -49,8 +58,8 @@ zrdz_disassembler::zrdz_disassembler(std::vector<section> &&sections, std::vecto
 	// sort labels...
 	for (auto &e : _sections) {
 		if (e.symbols.empty()) continue;
-		std::sort(e.symbols.begin(), e.symbols.end(), [](const symbol &a, const symbol &b) {
-			return a.offset > b.offset;
+		std::stable_sort(e.symbols.begin(), e.symbols.end(), [](const symbol &a, const symbol &b) {
+			return a.offset < b.offset;
 		});
 	}
 
@@ -100,8 +109,8 @@ void zrdz_disassembler::front_matter(const std::string &module) {
 		uint32_t pc = e.org;
 
 
-		for (; !e.symbols.empty(); e.symbols.pop_back()) {
-			auto &s = e.symbols.back();
+		for (; e.next < e.symbols.size(); ++e.next) {
+			auto &s = e.symbols[e.next];
 
 			if (s.offset > pc) {
 				emit("","ds", std::to_string(s.offset - pc));
@@ -319,11 +328,12 @@ void zrdz_disassembler::set_section(int section) {
 int32_t zrdz_disassembler::next_label(int32_t pc) {
 	if (_section < 0) return -1;
 
-	auto &symbols = _sections[_section].symbols;
+	auto &e = _sections[_section];
+	auto &symbols = e.symbols;
 	if (pc >= 0) {
 
-		for(; !symbols.empty(); symbols.pop_back()) {
-			auto &s = symbols.back();
+		for(; e.next < symbols.size(); ++e.next) {
+			auto &s = symbols[e.next];
 			if (s.offset > pc) return s.offset;
 			if (s.offset == pc) emit(s.name);
 			else {
@@ -333,8 +343,58 @@ int32_t zrdz_disassembler::next_label(int32_t pc) {
 		}
 
 	}
-	if (symbols.empty()) return -1;
-	return symbols.back().offset;
+	if (e.next == symbols.size()) return -1;
+	return symbols[e.next].offset;
+}
+
+
+void zrdz_disassembler::add_targets(unsigned section, const std::vector<uint32_t> &targets) {
+
+	if (section >= _sections.size()) return;
+	auto &e = _sections[section];
+
+	std::vector<symbol> tmp;
+	for (uint32_t offset : targets) {
+		if (offset < e.org || offset > e.org + e.size) continue;
+		e.targets.push_back(offset);
+		if (find_label(e, offset)) continue;
+
+		symbol s;
+		s.name = "@L" + to_x(offset, 4);
+		s.type = S_REL;
+		s.flags = SF_TMP;
+		s.section = section;
+		s.offset = offset;
+		tmp.emplace_back(std::move(s));
+	}
+	if (tmp.empty()) return;
+
+	// both are sorted, real symbols first.
+	auto mid = e.symbols.insert(e.symbols.end(),
+		std::make_move_iterator(tmp.begin()), std::make_move_iterator(tmp.end()));
+	std::inplace_merge(e.symbols.begin(), mid, e.symbols.end(), [](const symbol &a, const symbol &b) {
+		return a.offset < b.offset;
+	});
+}
+
+
+// first symbol at offset (real or local).
+const symbol *zrdz_disassembler::find_label(const entry &e, uint32_t offset) const {
+	auto iter = std::lower_bound(e.symbols.begin(), e.symbols.end(), offset, [](const symbol &s, uint32_t offset) {
+		return s.offset < offset;
+	});
+	if (iter == e.symbols.end() || iter->offset != offset) return nullptr;
+	return &*iter;
+}
+
+
+std::string zrdz_disassembler::label_for_address(uint32_t address) {
+	if (_section < 0) return "";
+
+	// only addresses the first pass identified as targets.
+	const auto &e = _sections[_section];
+	if (!std::binary_search(e.targets.begin(), e.targets.end(), address)) return "";
+	return location_name(_section, address);
 }
 
 
@@ -352,13 +412,12 @@ std::string zrdz_disassembler::location_name(unsigned section, uint32_t offset)
 
 	// todo -- need to verify relative/absolute value
 
-	auto iter = std::find_if(_symbols.begin(), _symbols.end(), [=](const symbol &s){
-		if (s.type == equ_type) return false;
-		if (s.type == S_UND) return false;
-		return s.section == section && s.offset == offset;
-	});
+	auto iter = _labels.find(((uint64_t)section << 32) | offset);
+	if (iter != _labels.end()) return _symbols[iter->second].name;
 
-	if (iter != _symbols.end()) return iter->name;
+	if (!e.targets.empty()) {
+		if (auto s = find_label(e, offset)) return s->name;
+	}
 
 	//fallback to section name + offset
 	std::string tmp = e.name;
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <stdint.h>
 #include "disassembler.h"
 #include "obj816.h"
@@ -37,6 +38,10 @@ public:
 	void front_matter(const std::string &module_name);
 	void back_matter(unsigned flags);
 
+	// branch/jump targets from a first pass (see analyzer). targets without
+	// a symbol get a local label.
+	void add_targets(unsigned section, const std::vector<uint32_t> &targets);
+
 	std::string location_name(unsigned section, uint32_t offset) const;
 	std::string symbol_name(unsigned entry) const;
 	std::string section_name(unsigned entry) const;
@@ -44,6 +49,7 @@ public:
 protected:
 
 	virtual int32_t next_label(int32_t pc) override;
+	virtual std::string label_for_address(uint32_t address) override;
 
 private:
 
@@ -54,16 +60,23 @@ private:
 
 		bool processed = false;
 		bool valid = false;
-		std::vector<symbol> symbols;
+		std::vector<symbol> symbols; // sorted by offset
+		size_t next = 0; // next symbol to place
+		std::vector<uint32_t> targets; // sorted
 		uint32_t pc = 0;
 	};
 
 	std::vector<symbol> _symbols;
 	std::vector<entry> _sections;
 
+	// (section << 32) | offset -> first matching entry in _symbols.
+	std::unordered_map<uint64_t, unsigned> _labels;
+
 	int _section = -1;
 
 
+	const symbol *find_label(const entry &e, uint32_t offset) const;
+
 	void print_section(const entry &e);
 	void print_externs();
 	void print_variables();